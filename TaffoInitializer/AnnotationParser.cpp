@@ -1,5 +1,8 @@
 #include <cctype>
 #include <climits>
+#include <cmath>
+#include <cstdlib>
+#include "llvm/ADT/SmallString.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/Debug.h"
 #include "AnnotationParser.h"
@@ -10,47 +13,65 @@ using namespace taffo;
 using namespace mdutils;
 
 
+static bool isDecimalDigit(char c)
+{
+  return isdigit(static_cast<unsigned char>(c));
+}
+
+
+static bool isSpaceChar(char c)
+{
+  return isspace(static_cast<unsigned char>(c));
+}
+
+
 void AnnotationParser::reset()
 {
   target = None;
   startingPoint = false;
   backtracking = false;
+  backtrackingDepth = 0;
   metadata.reset();
+  setError("");
 }
 
 
 bool AnnotationParser::parseAnnotationString(StringRef annstr)
 {
   reset();
-  sstream = std::istringstream(annstr.substr(0, annstr.size()));
-  
+  str = annstr;
+  pos = 0;
+
   bool res;
   if (annstr.find('(') == StringRef::npos)
     res = parseOldSyntax();
   else
     res = parseNewSyntax();
   if (res)
-    error = "";
+    setError("");
   return res;
 }
 
 
 StringRef AnnotationParser::lastError()
 {
+  error = errorPrefix;
+  error.append(errorSubject.begin(), errorSubject.end());
+  if (errorIndex >= 0)
+    error += " at character index " + std::to_string(errorIndex);
   return error;
 }
 
 
 bool AnnotationParser::parseOldSyntax()
 {
-  error = "Somebody used the old syntax and they should stop.";
+  setError("Somebody used the old syntax and they should stop.");
   bool readNumBits = true;
-  std::string head;
-  sstream >> head;
-  if (head.find("target:") == 0) {
-    target = head.substr(7); // strlen("target:") == 7
+  StringRef head = readOldToken();
+  if (head.startswith("target:")) {
+    target = head.substr(7).str(); // strlen("target:") == 7
     startingPoint = true;
-    sstream >> head;
+    head = readOldToken();
   }
   if (head == "no_float" || head == "force_no_float") {
     if (head == "no_float") {
@@ -59,23 +80,20 @@ bool AnnotationParser::parseOldSyntax()
       backtracking = true;
       backtrackingDepth = UINT_MAX;
     }
-    sstream >> head;
+    head = readOldToken();
   }
   if (head == "range")
     readNumBits = false;
   else
     return false;
-  
+
   mdutils::InputInfo *info = new mdutils::InputInfo(nullptr, nullptr, nullptr, true);
   metadata.reset(info);
 
   if (readNumBits) {
-    int intbits, fracbits;
-    sstream >> intbits >> fracbits;
-    if (!sstream.fail()) {
-      std::string signedflg;
-      sstream >> signedflg;
-      if (!sstream.fail() && signedflg == "unsigned") {
+    int64_t intbits, fracbits;
+    if (readOldInteger(intbits) && readOldInteger(fracbits)) {
+      if (readOldToken() == "unsigned") {
         info->IType.reset(new mdutils::FPType(intbits + fracbits, fracbits, false));
       } else {
         info->IType.reset(new mdutils::FPType(intbits + fracbits, fracbits, true));
@@ -85,30 +103,68 @@ bool AnnotationParser::parseOldSyntax()
 
   // Look for Range info
   double Min, Max;
-  sstream >> Min >> Max;
-  if (!sstream.fail()) {
+  if (readOldReal(Min) && readOldReal(Max)) {
     info->IRange.reset(new mdutils::Range(Min, Max));
     LLVM_DEBUG(dbgs() << "Range found: [" << Min << ", " << Max << "]\n");
 
     // Look for initial error
     double Error;
-    sstream >> Error;
-    if (!sstream.fail()) {
+    if (readOldReal(Error)) {
       LLVM_DEBUG(dbgs() << "Initial error found " << Error << "\n");
       info->IError.reset(new double(Error));
     }
   }
-  
+
+  return true;
+}
+
+
+/* The old syntax is made of tokens separated by whitespace; any other
+ * character (the string terminator included) belongs to a token. */
+StringRef AnnotationParser::readOldToken()
+{
+  while (pos < str.size() && isSpaceChar(str[pos]))
+    pos++;
+  size_t start = pos;
+  while (pos < str.size() && !isSpaceChar(str[pos]))
+    pos++;
+  return str.slice(start, pos);
+}
+
+
+bool AnnotationParser::readOldReal(double& res)
+{
+  while (pos < str.size() && isSpaceChar(str[pos]))
+    pos++;
+  return lexReal(res);
+}
+
+
+bool AnnotationParser::readOldInteger(int64_t& res)
+{
+  while (pos < str.size() && isSpaceChar(str[pos]))
+    pos++;
+  size_t start = pos;
+  bool neg = false;
+  if (current() == '+' || current() == '-')
+    neg = get() == '-';
+  if (!isDecimalDigit(current())) {
+    pos = start;
+    return false;
+  }
+  res = 0;
+  while (isDecimalDigit(current()))
+    res = res * 10 + (get() - '0');
+  if (neg)
+    res = -res;
   return true;
 }
 
 
 bool AnnotationParser::parseNewSyntax()
 {
-  sstream.unsetf(std::ios_base::skipws);
   char next = skipWhitespace();
-  sstream.putback(next);
-  
+
   while (next != '\0') {
     if (peek("target")) {
       std::string tgt;
@@ -117,7 +173,7 @@ bool AnnotationParser::parseNewSyntax()
       if (!expect(")")) return false;
       target = tgt;
       startingPoint = true;
-      
+
     } if (peek("errtarget")) {
       std::string tgt;
       if (!expect("(")) return false;
@@ -127,7 +183,9 @@ bool AnnotationParser::parseNewSyntax()
 
     } else if (peek("backtracking")) {
       if (peek("(")) {
-        if (!expectBoolean(backtracking)) {
+        if (expectBoolean(backtracking)) {
+          backtrackingDepth = backtracking ? UINT_MAX : 0;
+        } else {
           int64_t tmp;
           if (!expectInteger(tmp)) return false;
           backtrackingDepth = tmp;
@@ -138,24 +196,23 @@ bool AnnotationParser::parseNewSyntax()
         backtracking = true;
         backtrackingDepth = UINT_MAX;
       }
-      
+
     } else if (peek("struct")) {
       if (!parseStruct(metadata)) return false;
-      
+
     } else if (peek("scalar")) {
       if (!parseScalar(metadata)) return false;
-      
+
     } else {
-      error = "Unknown identifier at character index " + std::to_string(sstream.tellg());
+      setError("Unknown identifier", "", pos);
       return false;
     }
-    
+
     next = skipWhitespace();
-    sstream.putback(next);
   }
-  
+
   if (metadata.get() == nullptr) {
-    error = "scalar() or struct() top-level specifiers missing";
+    setError("scalar() or struct() top-level specifiers missing");
     return false;
   }
   return true;
@@ -165,14 +222,14 @@ bool AnnotationParser::parseNewSyntax()
 bool AnnotationParser::parseScalar(std::shared_ptr<MDInfo>& thisMd)
 {
   if (!expect("(")) return false;
-  
+
   if (thisMd.get() != nullptr) {
-    error = "Duplicated content definition in this context";
+    setError("Duplicated content definition in this context");
     return false;
   }
   InputInfo *ii = new InputInfo(nullptr, nullptr, nullptr, true);
   thisMd.reset(ii);
-  
+
   while (!peek(")")) {
     if (peek("range")) {
       ii->IRange.reset(new Range());
@@ -181,7 +238,7 @@ bool AnnotationParser::parseScalar(std::shared_ptr<MDInfo>& thisMd)
       if (!expect(",")) return false;
       if (!expectReal(ii->IRange->Max)) return false;
       if (!expect(")")) return false;
-      
+
     } else if (peek("type")) {
       if (!expect("(")) return false;
       bool isSignd = true;
@@ -195,19 +252,19 @@ bool AnnotationParser::parseScalar(std::shared_ptr<MDInfo>& thisMd)
       if (!expectInteger(frac)) return false;
       if (!expect(")")) return false;
       ii->IType.reset(new FPType(total, frac, isSignd));
-      
+
     } else if (peek("error")) {
       ii->IError = std::make_shared<double>(0);
       if (!expect("(")) return false;
       if (!expectReal(*(ii->IError))) return false;
       if (!expect(")")) return false;
-      
+
     } else if (peek("disabled")) {
       ii->IEnableConversion = false;
     } else if (peek("final")) {
       ii->IFinal = true;
     } else {
-      error = "Unknown identifier at character index " + std::to_string(sstream.tellg());
+      setError("Unknown identifier", "", pos);
       return false;
     }
   }
@@ -219,11 +276,11 @@ bool AnnotationParser::parseStruct(std::shared_ptr<MDInfo>& thisMd)
 {
   if (!expect("[")) return false;
   if (thisMd.get() != nullptr) {
-    error = "Duplicated content definition in this context";
+    setError("Duplicated content definition in this context");
     return false;
   }
   std::vector<std::shared_ptr<MDInfo>> elems;
-  
+
   bool first = true;
   while (!peek("]")) {
     if (first) {
@@ -231,28 +288,28 @@ bool AnnotationParser::parseStruct(std::shared_ptr<MDInfo>& thisMd)
     } else {
       if (!expect(",")) return false;
     }
-    
+
     if (peek("scalar")) {
       std::shared_ptr<MDInfo> tmp;
       if (!parseScalar(tmp)) return false;
       elems.push_back(tmp);
-      
+
     } else if (peek("struct")) {
       std::shared_ptr<MDInfo> tmp;
       if (!parseStruct(tmp)) return false;
       elems.push_back(tmp);
-      
+
     } else if (peek("void")) {
       elems.push_back(nullptr);
-      
+
     } else {
-      error = "Unknown identifier at character index " + std::to_string(sstream.tellg());
+      setError("Unknown identifier", "", pos);
       return false;
     }
   }
-  
+
   if (elems.size() == 0) {
-    error = "Empty structures not allowed";
+    setError("Empty structures not allowed");
     return false;
   }
   StructInfo *si = new StructInfo(elems);
@@ -261,50 +318,51 @@ bool AnnotationParser::parseStruct(std::shared_ptr<MDInfo>& thisMd)
 }
 
 
+/* Moves the cursor to the next character which is not blank, and returns it
+ * without consuming it. The string terminator is returned as '\0'. */
 char AnnotationParser::skipWhitespace()
 {
-  char tmp = '\0';
-  sstream >> tmp;
-  while (!sstream.eof() && tmp != '\0' && (isblank(tmp) || iscntrl(tmp)))
-    sstream >> tmp;
-  if (sstream.eof())
-    return '\0';
-  return tmp;
+  while (pos < str.size()) {
+    unsigned char c = str[pos];
+    if (c == '\0' || !(isblank(c) || iscntrl(c)))
+      break;
+    pos++;
+  }
+  return current();
 }
 
 
-bool AnnotationParser::expect(std::string kw)
+bool AnnotationParser::expect(StringRef kw)
 {
   char next = skipWhitespace();
-  error = "Expected " + kw + " at character index " + std::to_string((int)(sstream.tellg())-1);
+  setError("Expected ", kw, pos);
   if (next == '\0')
     return false;
-  int i = 0;
-  while (i < kw.size() && next != '\0' && next == kw[i]) {
+  size_t i = 0;
+  while (i < kw.size() && current() != '\0' && current() == kw[i]) {
     i++;
-    sstream >> next;
+    pos++;
   }
-  sstream.putback(next);
   return i == kw.size();
 }
 
 
 bool AnnotationParser::expectString(std::string& res)
 {
-  char next = skipWhitespace();
-  error = "Expected string at character index " + std::to_string((int)(sstream.tellg())-1);
-  res = "";
-  if (next != '\'')
+  skipWhitespace();
+  setError("Expected string", "", pos);
+  res.clear();
+  if (get() != '\'')
     return false;
-  sstream >> next;
+  char next = get();
   while (next != '\'' && next != '\0') {
     if (next == '@') {
-      sstream >> next;
+      next = get();
       if (next != '@' && next != '\'')
         return false;
     }
-    res.append(&next, 1);
-    sstream >> next;
+    res.push_back(next);
+    next = get();
   }
   if (next == '\'')
     return true;
@@ -314,36 +372,37 @@ bool AnnotationParser::expectString(std::string& res)
 
 bool AnnotationParser::expectInteger(int64_t& res)
 {
-  char next = skipWhitespace();
-  error = "Expected integer at character index " + std::to_string((int)(sstream.tellg())-1);
+  skipWhitespace();
+  setError("Expected integer", "", pos);
+  char next = get();
   bool neg = false;
   int base = 10;
   if (next == '+') {
-    sstream >> next;
+    next = get();
   } else if (next == '-') {
     neg = true;
-    sstream >> next;
+    next = get();
   }
   if (next == '0') {
     base = 8;
-    sstream >> next;
+    next = get();
     if (next == 'x') {
       base = 16;
-      sstream >> next;
+      next = get();
     }
   }
-  if (!isdigit(next))
+  if (!isDecimalDigit(next))
     return false;
   res = 0;
-  while (isdigit(next) || (base == 16 ? isxdigit(next) : false)) {
+  while (isDecimalDigit(next) || (base == 16 ? isxdigit(static_cast<unsigned char>(next)) : false)) {
     res *= base;
     if (next > '9')
       res += toupper(next) - 'A' + 10;
     else
       res += next - '0';
-    sstream >> next;
+    next = get();
   }
-  sstream.putback(next);
+  unget();
   if (neg)
     res = -res;
   return true;
@@ -352,25 +411,65 @@ bool AnnotationParser::expectInteger(int64_t& res)
 
 bool AnnotationParser::expectReal(double& res)
 {
-  char next = skipWhitespace();
-  error = "Expected real at character index " + std::to_string((int)(sstream.tellg())-1);
-  sstream.putback(next);
-  std::streampos pos = sstream.tellg();
-  sstream >> res;
-  if (sstream.fail()) {
-    sstream.clear();
-    sstream.seekg(pos);
+  skipWhitespace();
+  setError("Expected real", "", pos);
+  return lexReal(res);
+}
+
+
+/* Reads a decimal floating point number starting at the cursor, in the
+ * same format accepted by the C++ standard library streams:
+ *   [+|-] digits [. digits] [(e|E) [+|-] digits]
+ * where at least one digit must appear before the exponent.
+ * On failure the cursor is not moved. */
+bool AnnotationParser::lexReal(double& res)
+{
+  size_t start = pos;
+  if (current() == '+' || current() == '-')
+    pos++;
+  bool mantissa = false;
+  while (isDecimalDigit(current())) {
+    pos++;
+    mantissa = true;
+  }
+  if (current() == '.') {
+    pos++;
+    while (isDecimalDigit(current())) {
+      pos++;
+      mantissa = true;
+    }
+  }
+  if (mantissa && (current() == 'e' || current() == 'E')) {
+    pos++;
+    if (current() == '+' || current() == '-')
+      pos++;
+    if (!isDecimalDigit(current()))
+      mantissa = false;
+    while (isDecimalDigit(current()))
+      pos++;
+  }
+  if (!mantissa) {
+    pos = start;
     return false;
   }
+
+  /* strtod requires a terminated string, which is built on the stack unless
+   * the number is absurdly long */
+  SmallString<64> buf(str.slice(start, pos));
+  double val = std::strtod(buf.c_str(), nullptr);
+  if (std::isinf(val)) {
+    pos = start;
+    return false;
+  }
+  res = val;
   return true;
 }
 
 
 bool AnnotationParser::expectBoolean(bool& res)
 {
-  char next = skipWhitespace();
-  error = "Expected boolean at character index " + std::to_string((int)(sstream.tellg())-1);
-  sstream.putback(next);
+  skipWhitespace();
+  setError("Expected boolean", "", pos);
   if (peek("true") || peek("yes")) {
     res = true;
     return true;
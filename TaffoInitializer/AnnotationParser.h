@@ -1,5 +1,5 @@
 #include <string>
-#include <sstream>
+#include "llvm/ADT/StringRef.h"
 #include "TaffoInitializerPass.h"
 #include "InputInfo.h"
 
@@ -11,42 +11,71 @@
 namespace taffo {
 
 
+/* Parser of the annotation strings.
+ * The parser works on a cursor over the annotation string, and it does not
+ * allocate memory besides the parsed metadata. Error messages are only
+ * composed when requested through lastError(). */
 class AnnotationParser {
-  std::istringstream sstream;
-  std::string nextToken;
+  llvm::StringRef str;
+  size_t pos;
+
+  /* Last error, as "<errorPrefix><errorSubject> at character index <errorIndex>"
+   * (the index part is omitted when errorIndex is negative) */
+  const char *errorPrefix;
+  llvm::StringRef errorSubject;
+  int64_t errorIndex;
   std::string error;
-  
+
   void reset();
-  
+  void setError(const char *prefix, llvm::StringRef subject = "", int64_t index = -1) {
+    errorPrefix = prefix;
+    errorSubject = subject;
+    errorIndex = index;
+  };
+
+  char current() const {
+    return pos < str.size() ? str[pos] : '\0';
+  };
+  char get() {
+    char c = current();
+    pos++;
+    return c;
+  };
+  void unget() {
+    pos--;
+  };
+
   bool parseOldSyntax();
-  
+  llvm::StringRef readOldToken();
+  bool readOldReal(double& res);
+  bool readOldInteger(int64_t& res);
+
   bool parseNewSyntax();
   bool initializeInputInfo(std::shared_ptr<mdutils::MDInfo>& thisMd);
   bool parseScalar(std::shared_ptr<mdutils::MDInfo>& thisMd);
   bool parseStruct(std::shared_ptr<mdutils::MDInfo>& thisMd);
   char skipWhitespace();
   bool expectString(std::string& res);
-  bool peek(std::string kw) {
-    std::streampos pos = sstream.tellg();
+  bool peek(llvm::StringRef kw) {
+    size_t start = pos;
     bool res;
-    if (!(res = expect(kw))) {
-      sstream.clear();
-      sstream.seekg(pos);
-    }
+    if (!(res = expect(kw)))
+      pos = start;
     return res;
   };
-  bool expect(std::string kw);
+  bool expect(llvm::StringRef kw);
   bool expectInteger(int64_t& res);
   bool expectReal(double& res);
   bool expectBoolean(bool& res);
-  
+  bool lexReal(double& res);
+
 public:
   llvm::Optional<std::string> target;
   bool startingPoint;
   bool backtracking;
   unsigned int backtrackingDepth;
   std::shared_ptr<mdutils::MDInfo> metadata;
-  
+
   bool parseAnnotationString(llvm::StringRef annString);
   llvm::StringRef lastError();
 };
@@ -0,0 +1,132 @@
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "AnnotationSummary.h"
+
+
+using namespace llvm;
+using namespace taffo;
+
+
+static const int64_t SummaryVersion = 1;
+
+
+void AnnotationSummary::merge(const AnnotationSummary& other)
+{
+  globals.insert(other.globals.begin(), other.globals.end());
+  for (auto& F: other.functions) {
+    auto res = functions.insert(F);
+    if (!res.second && res.first->second.ret.empty())
+      res.first->second.ret = F.second.ret;
+  }
+  clones.insert(other.clones.begin(), other.clones.end());
+}
+
+
+void AnnotationSummary::write(raw_ostream& os) const
+{
+  json::Object globalList;
+  for (auto& G: globals)
+    globalList[G.first] = G.second;
+
+  json::Object functionList;
+  for (auto& F: functions) {
+    json::Object entry;
+    if (!F.second.ret.empty())
+      entry["ret"] = F.second.ret;
+    functionList[F.first] = std::move(entry);
+  }
+
+  json::Array cloneList;
+  for (auto& C: clones) {
+    json::Array args;
+    for (const std::string& arg: C.second.args) {
+      if (arg.empty())
+        args.push_back(nullptr);
+      else
+        args.push_back(arg);
+    }
+    cloneList.push_back(json::Object{
+      {"callee", C.first.first},
+      {"signature", C.first.second},
+      {"args", std::move(args)}});
+  }
+
+  json::Object summary{
+    {"version", SummaryVersion},
+    {"globals", std::move(globalList)},
+    {"functions", std::move(functionList)},
+    {"clones", std::move(cloneList)}};
+  os << formatv("{0:2}", json::Value(std::move(summary))) << "\n";
+}
+
+
+bool AnnotationSummary::mergeFile(StringRef path)
+{
+  auto fail = [&](const Twine& reason) -> bool {
+    errs() << "TAFFO initializer: can not import the summary " << path << ": " << reason << "\n";
+    return false;
+  };
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> buf = MemoryBuffer::getFile(path);
+  if (!buf)
+    return fail(buf.getError().message());
+  Expected<json::Value> parsed = json::parse((*buf)->getBuffer());
+  if (!parsed)
+    return fail(toString(parsed.takeError()));
+
+  const json::Object *root = parsed->getAsObject();
+  if (!root || root->getInteger("version") != SummaryVersion)
+    return fail("unsupported format");
+
+  AnnotationSummary res;
+  if (const json::Object *list = root->getObject("globals")) {
+    for (auto& G: *list) {
+      Optional<StringRef> info = G.second.getAsString();
+      if (!info)
+        return fail("malformed global " + G.first.str());
+      res.globals[G.first.str()] = info->str();
+    }
+  }
+  if (const json::Object *list = root->getObject("functions")) {
+    for (auto& F: *list) {
+      const json::Object *entry = F.second.getAsObject();
+      if (!entry)
+        return fail("malformed function " + F.first.str());
+      FunctionSummary& fs = res.functions[F.first.str()];
+      if (Optional<StringRef> ret = entry->getString("ret"))
+        fs.ret = ret->str();
+    }
+  }
+  if (const json::Array *list = root->getArray("clones")) {
+    for (const json::Value& C: *list) {
+      const json::Object *entry = C.getAsObject();
+      Optional<StringRef> callee = entry ? entry->getString("callee") : None;
+      Optional<StringRef> signature = entry ? entry->getString("signature") : None;
+      const json::Array *args = entry ? entry->getArray("args") : nullptr;
+      if (!callee || !signature || !args)
+        return fail("malformed clone request");
+      CloneRequest& req = res.clones[std::make_pair(callee->str(), signature->str())];
+      for (const json::Value& arg: *args) {
+        Optional<StringRef> info = arg.getAsString();
+        req.args.push_back(info ? info->str() : std::string());
+      }
+    }
+  }
+
+  merge(res);
+  return true;
+}
+
+
+std::string AnnotationSummary::getCloneName(StringRef callee, StringRef signature)
+{
+  MD5 hash;
+  hash.update(signature);
+  MD5::MD5Result res;
+  hash.final(res);
+  SmallString<32> digest = res.digest();
+  return (callee + ".taffo." + digest.str().substr(0, 16)).str();
+}
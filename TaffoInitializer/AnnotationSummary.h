@@ -0,0 +1,71 @@
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+
+#ifndef __TAFFO_ANNOTATION_SUMMARY_H__
+#define __TAFFO_ANNOTATION_SUMMARY_H__
+
+
+namespace taffo {
+
+
+/* Summary of the info which a module exports to the other modules of the
+ * program, in the spirit of the ThinLTO summaries.
+ *
+ * Each module emits its own summary (-taffo-init-summary-out). The summaries
+ * are then merged (the thin link), and each module is compiled again with the
+ * merged summary (-taffo-init-summary-in), which makes:
+ * - the annotated globals and the return info of the annotated functions
+ *   defined elsewhere roots of the module which uses them;
+ * - the calls to functions defined elsewhere with info on their arguments
+ *   call the clone specialized for that info;
+ * - the module which defines a function requested by the other modules
+ *   define the clones they call.
+ * The name of a clone depends only on the called function and on the
+ * signature of the call, therefore all the modules agree on it.
+ * The info is written in the syntax of InitializerCache::writeValueInfo. */
+class AnnotationSummary {
+public:
+  struct FunctionSummary {
+    /* info of the return value, empty if the function is not annotated */
+    std::string ret;
+  };
+
+  /* A clone requested by a call to a function defined in another module */
+  struct CloneRequest {
+    /* info of each argument, empty if the argument has no info */
+    std::vector<std::string> args;
+  };
+
+  /* annotated globals defined by the module, by name */
+  std::map<std::string, std::string> globals;
+  /* externally visible functions defined by the module, by name */
+  std::map<std::string, FunctionSummary> functions;
+  /* requested clones, by called function and call signature */
+  std::map<std::pair<std::string, std::string>, CloneRequest> clones;
+
+  bool empty() const {
+    return globals.empty() && functions.empty() && clones.empty();
+  }
+
+  /* Adds the content of other. The entries already present are kept. */
+  void merge(const AnnotationSummary& other);
+
+  void write(llvm::raw_ostream& os) const;
+  /* Merges the summary in the file at path into this one. Returns false
+   * (reporting the reason) if the file can not be read or parsed. */
+  bool mergeFile(llvm::StringRef path);
+
+  /* Name of the clone of callee for a call with the given signature */
+  static std::string getCloneName(llvm::StringRef callee, llvm::StringRef signature);
+};
+
+
+}
+
+
+#endif // __TAFFO_ANNOTATION_SUMMARY_H__
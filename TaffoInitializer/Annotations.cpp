@@ -1,5 +1,6 @@
 #include <sstream>
 #include <iostream>
+#include <algorithm>
 #include "llvm/Pass.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Function.h"
@@ -7,6 +8,7 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 #include "TaffoInitializerPass.h"
 #include "AnnotationParser.h"
@@ -17,7 +19,7 @@ using namespace taffo;
 
 
 void TaffoInitializer::readGlobalAnnotations(Module &m,
-    MultiValueMap<Value *, ValueInfo>& variables,
+    ConvQueueT& variables,
 		bool functionAnnotation)
 {
   GlobalVariable *globAnnos = m.getGlobalVariable("llvm.global.annotations");
@@ -50,81 +52,233 @@ void TaffoInitializer::readGlobalAnnotations(Module &m,
 }
 
 
-void TaffoInitializer::readLocalAnnotations(llvm::Function &f, MultiValueMap<Value *, ValueInfo>& variables)
+static GlobalVariable *getAnnotationContent(ConstantExpr *annoPtrInst)
 {
-  bool found = false;
+  if (!(annoPtrInst->getOpcode() == Instruction::GetElementPtr))
+    return nullptr;
+  return dyn_cast<GlobalVariable>(annoPtrInst->getOperand(0));
+}
+
+
+void TaffoInitializer::readLocalAnnotations(llvm::Function &f, ConvQueueT& variables)
+{
+  LocalAnnotationScan scan;
+  scanLocalAnnotations(f, scan);
+  parseLocalAnnotations(scan);
+  for (auto& C: scan.calls)
+    mergeLocalAnnotations(*C.first, C.second, scan, variables);
+}
+
+
+/* Finds the annotation calls in f and the annotation strings which are neither
+ * in the cache nor already found in the previous functions. Only reads the IR
+ * and the cache. */
+void TaffoInitializer::scanLocalAnnotations(llvm::Function &f, LocalAnnotationScan& res) const
+{
+  SmallVector<CallInst *, 8> calls;
   for (inst_iterator iIt = inst_begin(&f), iItEnd = inst_end(&f); iIt != iItEnd; iIt++) {
     if (CallInst *call = dyn_cast<CallInst>(&(*iIt))) {
       if (!call->getCalledFunction())
         continue;
 
       if (call->getCalledFunction()->getName() == "llvm.var.annotation") {
-        bool startingPoint = false;
-        parseAnnotation(variables, cast<ConstantExpr>(iIt->getOperand(1)), iIt->getOperand(0), &startingPoint);
-        found |= startingPoint;
+        calls.push_back(call);
+        GlobalVariable *annoContent = getAnnotationContent(cast<ConstantExpr>(call->getOperand(1)));
+        if (!annoContent || annotationCache.count(annoContent) || !res.fresh.insert(annoContent).second)
+          continue;
+        res.pending.push_back(annoContent);
       }
     }
   }
+  if (!calls.empty())
+    res.calls.push_back(std::make_pair(&f, std::move(calls)));
+}
+
+
+/* Parses the pending annotation strings, concurrently if more threads are
+ * allowed, and caches them in order of first use. */
+void TaffoInitializer::parseLocalAnnotations(LocalAnnotationScan& scan)
+{
+  std::vector<ParsedAnnotation> parsed(scan.pending.size());
+  unsigned threads = getThreadCount();
+  if (threads <= 1 || parsed.size() <= 1) {
+    for (size_t i = 0; i < parsed.size(); i++)
+      parsed[i] = parseAnnotationContent(scan.pending[i]);
+  } else {
+    /* Each task parses a contiguous block of strings and writes only to the
+     * results of that block */
+    size_t blockSize = std::max<size_t>(1, parsed.size() / (threads * 4));
+    ThreadPool pool(threads);
+    for (size_t begin = 0; begin < parsed.size(); begin += blockSize) {
+      size_t end = std::min(parsed.size(), begin + blockSize);
+      pool.async([&scan, &parsed, begin, end]() {
+        for (size_t i = begin; i < end; i++)
+          parsed[i] = parseAnnotationContent(scan.pending[i]);
+      });
+    }
+    pool.wait();
+  }
+
+  for (size_t i = 0; i < parsed.size(); i++)
+    cacheParsedAnnotation(scan.pending[i], std::move(parsed[i]));
+  scan.pending.clear();
+}
+
+
+/* Adds the annotation calls of f to the queue. Must be called on the functions
+ * in module order to keep the result deterministic. */
+void TaffoInitializer::mergeLocalAnnotations(llvm::Function &f, ArrayRef<CallInst *> calls,
+    LocalAnnotationScan& scan, ConvQueueT& variables)
+{
+  /* remembered for the clones of f, the calls are removed from f when
+   * their annotation has been propagated */
+  auto& remembered = localAnnotationCalls[&f];
+  remembered.clear();
+  remembered.append(calls.begin(), calls.end());
+
+  bool found = false;
+  for (CallInst *call: calls) {
+    bool startingPoint = false;
+    /* the first use of a string parsed by parseLocalAnnotations is already
+     * counted as a miss, the following ones are cache hits */
+    GlobalVariable *annoContent = getAnnotationContent(cast<ConstantExpr>(call->getOperand(1)));
+    if (annoContent && scan.fresh.erase(annoContent)) {
+      parseAnnotation(variables, &annotationCache.find(annoContent)->second, call->getOperand(0), &startingPoint);
+    } else {
+      parseAnnotation(variables, cast<ConstantExpr>(call->getOperand(1)), call->getOperand(0), &startingPoint);
+    }
+    found |= startingPoint;
+  }
   if (found) {
     mdutils::MetadataManager::setStartingPoint(f);
+    changes.metadata = true;
   }
 }
 
 
-void TaffoInitializer::readAllLocalAnnotations(llvm::Module &m, MultiValueMap<Value *, ValueInfo>& res)
+void TaffoInitializer::readAllLocalAnnotations(llvm::Module &m, ConvQueueT& res)
 {
+  LocalAnnotationScan scan;
+  for (Function &f: m.functions())
+    scanLocalAnnotations(f, scan);
+  parseLocalAnnotations(scan);
+
+  auto C = scan.calls.begin();
   for (Function &f: m.functions()) {
-    MultiValueMap<Value *, ValueInfo> t;
-    readLocalAnnotations(f, t);
-    res.insert(res.end(), t.begin(), t.end());
+    if (C != scan.calls.end() && C->first == &f) {
+      ConvQueueT t;
+      mergeLocalAnnotations(f, C->second, scan, t);
+      res.insert(res.end(), t.begin(), t.end());
+      ++C;
+    } else {
+      localAnnotationCalls.erase(&f);
+    }
 
     /* Otherwise dce pass ignores the function
      * (removed also where it's not required) */
-    f.removeFnAttr(Attribute::OptimizeNone);
+    if (f.hasFnAttribute(Attribute::OptimizeNone)) {
+      f.removeFnAttr(Attribute::OptimizeNone);
+      changes.metadata = true;
+    }
   }
 }
 
-// Return true on success, false on error
-bool TaffoInitializer::parseAnnotation(MultiValueMap<Value *, ValueInfo>& variables,
-				       ConstantExpr *annoPtrInst, Value *instr,
-				       bool *startingPoint)
-{
-  ValueInfo vi;
 
-  if (!(annoPtrInst->getOpcode() == Instruction::GetElementPtr))
-    return false;
-  GlobalVariable *annoContent = dyn_cast<GlobalVariable>(annoPtrInst->getOperand(0));
-  if (!annoContent)
-    return false;
+/* Parses an annotation string without touching the state of the pass. */
+ParsedAnnotation TaffoInitializer::parseAnnotationContent(GlobalVariable *annoContent)
+{
+  ParsedAnnotation res;
   ConstantDataSequential *annoStr = dyn_cast<ConstantDataSequential>(annoContent->getInitializer());
   if (!annoStr)
-    return false;
+    return res;
   if (!(annoStr->isString()))
-    return false;
+    return res;
 
   StringRef annstr = annoStr->getAsString();
   AnnotationParser parser;
   if (!parser.parseAnnotationString(annstr)) {
-    errs() << "TAFFO annnotation parser syntax error: \n";
-    errs() << "  In annotation: \"" << annstr << "\"\n";
-    errs() << "  " << parser.lastError() << "\n";
-    return false;
+    raw_string_ostream err(res.error);
+    err << "TAFFO annnotation parser syntax error: \n";
+    err << "  In annotation: \"" << annstr << "\"\n";
+    err << "  " << parser.lastError() << "\n";
+    return res;
+  }
+  res.valid = true;
+  res.parsedMetadata = parser.metadata;
+  res.parsedTarget = parser.target;
+  res.backtracking = parser.backtracking;
+  res.backtrackingDepth = parser.backtrackingDepth;
+  res.startingPoint = parser.startingPoint;
+  return res;
+}
+
+
+/* Invalid annotations are cached as well, in order to report each syntax
+ * error only once */
+const ParsedAnnotation *TaffoInitializer::cacheParsedAnnotation(GlobalVariable *annoContent, ParsedAnnotation&& parsed)
+{
+  AnnotationCacheMisses++;
+  ParsedAnnotation& res = annotationCache[annoContent];
+  res = std::move(parsed);
+  if (!res.error.empty())
+    errs() << res.error;
+  res.metadata = mdInfoStore->intern(res.parsedMetadata);
+  if (res.parsedTarget.hasValue())
+    res.target = mdInfoStore->internTarget(res.parsedTarget.getValue());
+  res.parsedMetadata.reset();
+  res.parsedTarget.reset();
+  return &res;
+}
+
+
+const ParsedAnnotation *TaffoInitializer::getParsedAnnotation(GlobalVariable *annoContent)
+{
+  auto cached = annotationCache.find(annoContent);
+  if (cached != annotationCache.end()) {
+    AnnotationCacheHits++;
+    return &cached->second;
   }
+  return cacheParsedAnnotation(annoContent, parseAnnotationContent(annoContent));
+}
+
+
+// Return true on success, false on error
+bool TaffoInitializer::parseAnnotation(ConvQueueT& variables,
+				       ConstantExpr *annoPtrInst, Value *instr,
+				       bool *startingPoint)
+{
+  GlobalVariable *annoContent = getAnnotationContent(annoPtrInst);
+  if (!annoContent)
+    return false;
+  return parseAnnotation(variables, getParsedAnnotation(annoContent), instr, startingPoint);
+}
+
+
+bool TaffoInitializer::parseAnnotation(ConvQueueT& variables,
+				       const ParsedAnnotation *parsed, Value *instr,
+				       bool *startingPoint)
+{
+  ValueInfo vi;
+
+  if (!parsed->valid)
+    return false;
+
   vi.fixpTypeRootDistance = 0;
-  if (!parser.backtracking)
+  if (!parsed->backtracking)
     vi.backtrackingDepthLeft = 0;
   else
-    vi.backtrackingDepthLeft = parser.backtrackingDepth;
-  vi.metadata = parser.metadata;
+    vi.backtrackingDepthLeft = parsed->backtrackingDepth;
+  vi.metadata = parsed->metadata;
   if (startingPoint)
-    *startingPoint = parser.startingPoint;
-  vi.target = parser.target;
+    *startingPoint = parsed->startingPoint;
+  vi.target = parsed->target;
 
   if (Instruction *toconv = dyn_cast<Instruction>(instr)) {
     variables.push_back(toconv->getOperand(0), vi);
     
   } else if (Function *fun = dyn_cast<Function>(instr)) {
     enabledFunctions.insert(fun);
+    functionAnnotations[fun] = vi;
     for (auto user: fun->users()) {
       if (!(isa<CallInst>(user) || isa<InvokeInst>(user)))
         continue;
@@ -139,9 +293,9 @@ bool TaffoInitializer::parseAnnotation(MultiValueMap<Value *, ValueInfo>& variab
 }
 
 
-void TaffoInitializer::removeNoFloatTy(MultiValueMap<Value *, ValueInfo>& res)
+void TaffoInitializer::removeNoFloatTy(ConvQueueT& res)
 {
-  for (auto PIt: res) {
+  for (auto PIt = res.begin(); PIt != res.end();) {
     Type *ty;
     Value *it = PIt->first;
 
@@ -151,12 +305,14 @@ void TaffoInitializer::removeNoFloatTy(MultiValueMap<Value *, ValueInfo>& res)
       ty = global->getType();
     } else if (isa<CallInst>(it) || isa<InvokeInst>(it)) {
       ty = it->getType();
-      if (ty->isVoidTy())
+      if (ty->isVoidTy()) {
+        ++PIt;
         continue;
+      }
     } else {
       LLVM_DEBUG(dbgs() << "annotated instruction " << *it <<
         " not an alloca or a global, ignored\n");
-      res.erase(it);
+      PIt = res.erase(PIt);
       continue;
     }
 
@@ -169,22 +325,24 @@ void TaffoInitializer::removeNoFloatTy(MultiValueMap<Value *, ValueInfo>& res)
     if (!ty->isFloatingPointTy()) {
       LLVM_DEBUG(dbgs() << "annotated instruction " << *it << " does not allocate a"
         " kind of float; ignored\n");
-      res.erase(it);
+      PIt = res.erase(PIt);
+      continue;
     }
+    ++PIt;
   }
 }
 
 void TaffoInitializer::printAnnotatedObj(Module &m)
 {
-  MultiValueMap<Value *, ValueInfo> res;
+  ConvQueueT res;
 
   readGlobalAnnotations(m, res, true);
   errs() << "Annotated Function: \n";
   if(!res.empty())
   {
-    for (auto it : res)
+    for (auto& it : res)
     {
-      errs() << " -> " << *it->first << "\n";
+      errs() << " -> " << *it.first << "\n";
     }
     errs() << "\n";
   }
@@ -194,9 +352,9 @@ void TaffoInitializer::printAnnotatedObj(Module &m)
   errs() << "Global Set: \n";
   if(!res.empty())
   {
-    for (auto it : res)
+    for (auto& it : res)
     {
-      errs() << " -> " << *it->first << "\n";
+      errs() << " -> " << *it.first << "\n";
     }
     errs() << "\n";
   }
@@ -210,9 +368,9 @@ void TaffoInitializer::printAnnotatedObj(Module &m)
     if(!res.empty())
     {
       errs() << "\nLocal Set: \n";
-      for (auto it : res)
+      for (auto& it : res)
       {
-        errs() << " -> " << *it->first << "\n";
+        errs() << " -> " << *it.first << "\n";
       }
     }
     errs() << "\n";
@@ -0,0 +1,72 @@
+#include "BacktrackingSlicer.h"
+
+
+using namespace llvm;
+using namespace taffo;
+
+
+constexpr unsigned int BacktrackingSlicer::Unbounded;
+
+
+void BacktrackingSlicer::addRoot(Value *root)
+{
+  Attribution& A = rootOf[root];
+  A.root = root;
+  A.pulled = false;
+}
+
+
+void BacktrackingSlicer::enqueued(Value *v, Value *from, bool backward)
+{
+  auto F = rootOf.find(from);
+  if (F == rootOf.end())
+    return;
+  Attribution A;
+  A.root = F->second.root;
+  A.pulled = backward || F->second.pulled;
+  rootOf.insert(std::make_pair(v, A));
+}
+
+
+void BacktrackingSlicer::import(Value *v, Value *root, bool pulled)
+{
+  if (!root)
+    return;
+  Attribution A;
+  A.root = root;
+  A.pulled = pulled;
+  rootOf.insert(std::make_pair(v, A));
+}
+
+
+/* The values already attributed keep their root, therefore the slicers
+ * must be merged in a deterministic order */
+void BacktrackingSlicer::merge(const BacktrackingSlicer& other)
+{
+  for (auto& I: other.rootOf)
+    rootOf.insert(I);
+}
+
+
+void BacktrackingSlicer::forget(const DenseSet<Value *>& deleted)
+{
+  if (deleted.empty())
+    return;
+  for (auto I = rootOf.begin(), E = rootOf.end(); I != E; ++I) {
+    if (deleted.count(I->first) || deleted.count(I->second.root))
+      rootOf.erase(I);
+  }
+}
+
+
+DenseMap<const Value *, unsigned int> BacktrackingSlicer::getSliceSizes() const
+{
+  DenseMap<const Value *, unsigned int> res;
+  for (auto& I: rootOf) {
+    if (I.second.pulled)
+      res[I.second.root]++;
+    else if (I.first == I.second.root)
+      res[I.first];
+  }
+  return res;
+}
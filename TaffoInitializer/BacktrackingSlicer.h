@@ -0,0 +1,75 @@
+#include <climits>
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/IR/Value.h"
+
+
+#ifndef __TAFFO_BACKTRACKING_SLICER_H__
+#define __TAFFO_BACKTRACKING_SLICER_H__
+
+
+namespace taffo {
+
+
+/* Backward slices of the roots with backtracking enabled.
+ *
+ * The backtracking depth left of a value is the memo of the slice explored
+ * from it: the operands of a value are walked again only when its depth
+ * increases. Unbounded backtracking (force_no_float, or backtracking without
+ * a depth) is therefore never decremented, otherwise every path leading to a
+ * value would give it a different depth, and the operands of the value would
+ * be walked once per path.
+ *
+ * The slicer also records the root which pulled in each value: a value
+ * belongs to the slice of a root if it was enqueued as an operand of a value
+ * reached from the root, or as a user of a value of the slice. */
+class BacktrackingSlicer {
+public:
+  static constexpr unsigned int Unbounded = UINT_MAX;
+
+  /* Depth left to the values reached from a value with the given depth */
+  static unsigned int nextDepth(unsigned int depth) {
+    if (depth == Unbounded || depth == 0)
+      return depth;
+    return depth - 1;
+  }
+
+  void addRoot(llvm::Value *root);
+  /* Records that v was enqueued for the first time while propagating the
+   * info of from */
+  void enqueued(llvm::Value *v, llvm::Value *from, bool backward);
+  /* Imports the attribution of a value of another slicer */
+  void import(llvm::Value *v, llvm::Value *root, bool pulled);
+  void merge(const BacktrackingSlicer& other);
+  /* Removes the values which are about to be deleted, together with the
+   * slices of such roots. The values are only compared by address, so they
+   * may already have been erased. */
+  void forget(const llvm::DenseSet<llvm::Value *>& deleted);
+
+  llvm::Value *getRoot(llvm::Value *v) const {
+    return rootOf.lookup(v).root;
+  }
+  bool isPulled(llvm::Value *v) const {
+    return rootOf.lookup(v).pulled;
+  }
+
+  /* Number of values pulled in by each root */
+  llvm::DenseMap<const llvm::Value *, unsigned int> getSliceSizes() const;
+  void clear() {
+    rootOf.clear();
+  }
+
+private:
+  struct Attribution {
+    llvm::Value *root = nullptr;
+    /* false for the values reached from the root without backtracking */
+    bool pulled = false;
+  };
+  llvm::DenseMap<llvm::Value *, Attribution> rootOf;
+};
+
+
+}
+
+
+#endif // __TAFFO_BACKTRACKING_SLICER_H__
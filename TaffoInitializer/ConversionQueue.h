@@ -0,0 +1,269 @@
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <utility>
+#include "llvm/ADT/DenseMap.h"
+
+
+#ifndef __TAFFO_CONVERSION_QUEUE_H__
+#define __TAFFO_CONVERSION_QUEUE_H__
+
+
+namespace taffo {
+
+
+/* Insertion-ordered map used as the conversion queue.
+ *
+ * Lookup, erase, insertion before any position and moving an element to the
+ * back or before another element are all O(1). Iterators are stable: they are
+ * invalidated only by erasing the element they point to.
+ * Every element carries an order label, which allows to check in O(1) whether
+ * an element precedes another one. Labels are spaced apart, and only the
+ * neighbourhood of an insertion is relabeled when it runs out of room. */
+template <typename KeyT, typename ValueT>
+class ConversionQueue {
+public:
+  using value_type = std::pair<const KeyT, ValueT>;
+
+private:
+  struct Node {
+    value_type entry;
+    uint64_t label;
+
+    template <typename VT>
+    Node(const KeyT& k, VT&& v): entry(k, std::forward<VT>(v)), label(0) {}
+  };
+  using ListT = std::list<Node>;
+
+  static constexpr uint64_t LabelGap = UINT64_C(1) << 32;
+
+  ListT list;
+  llvm::DenseMap<KeyT, typename ListT::iterator> index;
+
+  template <typename ListItT, typename RefT>
+  class iterator_impl {
+    friend class ConversionQueue;
+    ListItT it;
+    ListItT listEnd;
+
+    iterator_impl(ListItT it, ListItT listEnd): it(it), listEnd(listEnd) {}
+
+  public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = ConversionQueue::value_type;
+    using difference_type = std::ptrdiff_t;
+    using reference = RefT&;
+    using pointer = RefT*;
+
+    iterator_impl() = default;
+    template <typename OtherItT, typename OtherRefT>
+    iterator_impl(const iterator_impl<OtherItT, OtherRefT>& other): it(other.it), listEnd(other.listEnd) {}
+
+    reference operator*() const { return it->entry; }
+    pointer operator->() const { return &it->entry; }
+    iterator_impl& operator++() { ++it; return *this; }
+    iterator_impl operator++(int) { iterator_impl tmp = *this; ++it; return tmp; }
+    iterator_impl& operator--() { --it; return *this; }
+    iterator_impl operator--(int) { iterator_impl tmp = *this; --it; return tmp; }
+
+    template <typename OtherItT, typename OtherRefT>
+    bool operator==(const iterator_impl<OtherItT, OtherRefT>& other) const { return it == other.it; }
+    template <typename OtherItT, typename OtherRefT>
+    bool operator!=(const iterator_impl<OtherItT, OtherRefT>& other) const { return it != other.it; }
+
+    /* True if this element comes before the other one in the queue.
+     * The end iterator comes after every element. */
+    template <typename OtherItT, typename OtherRefT>
+    bool operator<(const iterator_impl<OtherItT, OtherRefT>& other) const {
+      if (it == listEnd)
+        return false;
+      if (other.it == other.listEnd)
+        return true;
+      return it->label < other.it->label;
+    }
+
+    template <typename, typename> friend class iterator_impl;
+  };
+
+public:
+  using iterator = iterator_impl<typename ListT::iterator, value_type>;
+  using const_iterator = iterator_impl<typename ListT::const_iterator, const value_type>;
+
+  ConversionQueue() = default;
+  ConversionQueue(const ConversionQueue& other) {
+    insert(end(), other.begin(), other.end());
+  }
+  ConversionQueue(ConversionQueue&& other) = default;
+  ConversionQueue& operator=(const ConversionQueue& other) {
+    if (this != &other) {
+      clear();
+      insert(end(), other.begin(), other.end());
+    }
+    return *this;
+  }
+  ConversionQueue& operator=(ConversionQueue&& other) = default;
+
+  iterator begin() { return wrap(list.begin()); }
+  iterator end() { return wrap(list.end()); }
+  const_iterator begin() const { return wrap(list.begin()); }
+  const_iterator end() const { return wrap(list.end()); }
+
+  size_t size() const { return index.size(); }
+  /* Approximate memory used by the queue, in bytes */
+  size_t getMemorySize() const {
+    return list.size() * (sizeof(Node) + 2 * sizeof(void *)) + index.getMemorySize();
+  }
+  bool empty() const { return index.empty(); }
+
+  void clear() {
+    list.clear();
+    index.clear();
+  }
+
+  iterator find(const KeyT& k) {
+    auto I = index.find(k);
+    if (I == index.end())
+      return end();
+    return wrap(I->second);
+  }
+
+  const_iterator find(const KeyT& k) const {
+    auto I = index.find(k);
+    if (I == index.end())
+      return end();
+    return wrap(typename ListT::const_iterator(I->second));
+  }
+
+  size_t count(const KeyT& k) const { return index.count(k); }
+
+  /* Returns the value associated to k, appending a default-constructed one
+   * at the end of the queue if k is not present. */
+  ValueT& operator[](const KeyT& k) {
+    return push_back(k, ValueT()).first->second;
+  }
+
+  /* Inserts (k, v) before pos. If k is already present nothing is inserted
+   * and the existing element is returned. */
+  template <typename VT>
+  std::pair<iterator, bool> insert(iterator pos, const KeyT& k, VT&& v) {
+    auto I = index.find(k);
+    if (I != index.end())
+      return std::make_pair(wrap(I->second), false);
+    auto N = list.emplace(pos.it, k, std::forward<VT>(v));
+    index[k] = N;
+    assignLabel(N);
+    return std::make_pair(wrap(N), true);
+  }
+
+  std::pair<iterator, bool> insert(iterator pos, const value_type& kv) {
+    return insert(pos, kv.first, kv.second);
+  }
+
+  template <typename InputIt, typename = decltype(std::declval<InputIt>()->first)>
+  void insert(iterator pos, InputIt first, InputIt last) {
+    for (; first != last; ++first)
+      insert(pos, first->first, first->second);
+  }
+
+  template <typename VT>
+  std::pair<iterator, bool> push_back(const KeyT& k, VT&& v) {
+    return insert(end(), k, std::forward<VT>(v));
+  }
+
+  std::pair<iterator, bool> push_back(const value_type& kv) {
+    return insert(end(), kv.first, kv.second);
+  }
+
+  iterator erase(iterator pos) {
+    assert(pos != end() && "erasing the end of the queue");
+    index.erase(pos->first);
+    return wrap(list.erase(pos.it));
+  }
+
+  size_t erase(const KeyT& k) {
+    auto I = index.find(k);
+    if (I == index.end())
+      return 0;
+    list.erase(I->second);
+    index.erase(I);
+    return 1;
+  }
+
+  /* Moves the element at it right before pos, keeping its value. */
+  iterator move(iterator it, iterator pos) {
+    assert(it != end() && "moving the end of the queue");
+    if (it == pos)
+      return it;
+    list.splice(pos.it, list, it.it);
+    assignLabel(it.it);
+    return it;
+  }
+
+  iterator moveToBack(iterator it) {
+    return move(it, end());
+  }
+
+private:
+  iterator wrap(typename ListT::iterator I) {
+    return iterator(I, list.end());
+  }
+
+  const_iterator wrap(typename ListT::const_iterator I) const {
+    return const_iterator(I, list.end());
+  }
+
+  /* Gives N a label strictly between the ones of its neighbours. */
+  void assignLabel(typename ListT::iterator N) {
+    uint64_t lo = N == list.begin() ? 0 : std::prev(N)->label;
+    auto after = std::next(N);
+    uint64_t hi;
+    if (after != list.end())
+      hi = after->label;
+    else if (lo <= std::numeric_limits<uint64_t>::max() - LabelGap)
+      hi = lo + LabelGap;
+    else
+      hi = std::numeric_limits<uint64_t>::max();
+
+    if (hi - lo < 2) {
+      relabelAround(N);
+      return;
+    }
+    N->label = lo + (hi - lo) / 2;
+  }
+
+  /* Spreads evenly the labels of a window of elements around N, doubling the
+   * window until the labels available around it leave a gap at least as
+   * large as the number of elements in the window. */
+  void relabelAround(typename ListT::iterator N) {
+    auto first = N;
+    auto last = std::next(N);
+    uint64_t count = 1;
+    for (uint64_t span = 1; ; span *= 2) {
+      for (uint64_t i = 0; i < span && first != list.begin(); i++, count++)
+        --first;
+      for (uint64_t i = 0; i < span && last != list.end(); i++, count++)
+        ++last;
+
+      uint64_t lo = first == list.begin() ? 0 : std::prev(first)->label;
+      uint64_t hi = last == list.end() ? std::numeric_limits<uint64_t>::max() : last->label;
+      uint64_t step = (hi - lo) / (count + 1);
+      if (step < count && !(first == list.begin() && last == list.end()))
+        continue;
+
+      assert(step > 0 && "conversion queue too large to be labeled");
+      for (auto I = first; I != last; ++I) {
+        lo += step;
+        I->label = lo;
+      }
+      return;
+    }
+  }
+};
+
+
+}
+
+
+#endif // __TAFFO_CONVERSION_QUEUE_H__
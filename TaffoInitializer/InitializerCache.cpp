@@ -0,0 +1,197 @@
+#include <chrono>
+#include <cmath>
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/Debug.h"
+#include "InitializerCache.h"
+#include "AnnotationParser.h"
+
+
+using namespace llvm;
+using namespace taffo;
+using namespace mdutils;
+
+
+InitializerCache::InitializerCache(StringRef dir): dir(dir)
+{
+  if (std::error_code EC = sys::fs::create_directories(dir))
+    errs() << "TAFFO initializer cache: can not create " << dir << ": " << EC.message() << "\n";
+}
+
+
+std::string InitializerCache::entryPath(StringRef key) const
+{
+  SmallString<128> path(dir);
+  sys::path::append(path, "llvmcache-taffoinit-" + key);
+  return std::string(path.str());
+}
+
+
+std::unique_ptr<MemoryBuffer> InitializerCache::lookup(StringRef key)
+{
+  std::string path = entryPath(key);
+  int fd;
+  if (sys::fs::openFileForRead(path, fd))
+    return nullptr;
+  ErrorOr<std::unique_ptr<MemoryBuffer>> buf = MemoryBuffer::getOpenFile(fd, path, -1);
+  /* the entry was used, keep it from being evicted; if the time can not be
+   * set the entry is still valid, it may only be pruned earlier */
+  if (std::error_code EC = sys::fs::setLastAccessAndModificationTime(fd, std::chrono::system_clock::now()))
+    LLVM_DEBUG(dbgs() << "initializer cache: can not update the time of " << path << ": " << EC.message() << "\n");
+  sys::Process::SafelyCloseFileDescriptor(fd);
+  if (!buf)
+    return nullptr;
+  return std::move(*buf);
+}
+
+
+void InitializerCache::store(StringRef key, StringRef data)
+{
+  /* write a temporary file and rename it, so that concurrent readers
+   * (other threads or other compilations) never see partial entries */
+  SmallString<128> model(dir);
+  sys::path::append(model, "taffoinit-tmp-%%%%%%%%");
+  Expected<sys::fs::TempFile> tmp = sys::fs::TempFile::create(model);
+  if (!tmp) {
+    consumeError(tmp.takeError());
+    return;
+  }
+  {
+    raw_fd_ostream os(tmp->FD, /* shouldClose */ false);
+    os << data;
+  }
+  if (Error E = tmp->keep(entryPath(key)))
+    consumeError(std::move(E));
+}
+
+
+void InitializerCache::prune(StringRef policy)
+{
+  Expected<CachePruningPolicy> P = parseCachePruningPolicy(policy);
+  if (!P) {
+    errs() << "TAFFO initializer cache: " << toString(P.takeError()) << "\n";
+    return;
+  }
+  pruneCache(dir, *P);
+}
+
+
+namespace {
+
+/* The annotation parser reads a lone 0 as the start of an octal number
+ * without digits */
+void writeInteger(raw_ostream& os, int64_t i)
+{
+  if (i == 0)
+    os << "00";
+  else
+    os << i;
+}
+
+
+bool writeReal(raw_ostream& os, double d)
+{
+  if (!std::isfinite(d))
+    return false;
+  os << format("%.17g", d);
+  return true;
+}
+
+}
+
+
+bool InitializerCache::writeMDInfo(raw_ostream& os, const MDInfo *mdi)
+{
+  if (const StructInfo *si = dyn_cast<StructInfo>(mdi)) {
+    if (si->size() == 0)
+      return false;
+    os << "struct[";
+    for (unsigned i = 0; i < si->size(); i++) {
+      if (i > 0)
+        os << ", ";
+      MDInfo *field = si->getField(i).get();
+      if (!field)
+        os << "void";
+      else if (!writeMDInfo(os, field))
+        return false;
+    }
+    os << "]";
+    return true;
+  }
+
+  const InputInfo *ii = cast<InputInfo>(mdi);
+  os << "scalar(";
+  if (ii->IType) {
+    FPType *fpt = dyn_cast<FPType>(ii->IType.get());
+    if (!fpt)
+      return false;
+    os << "type(" << (fpt->isSigned() ? "signed " : "unsigned ");
+    writeInteger(os, fpt->getWidth());
+    os << " ";
+    writeInteger(os, fpt->getPointPos());
+    os << ") ";
+  }
+  if (ii->IRange) {
+    os << "range(";
+    if (!writeReal(os, ii->IRange->Min))
+      return false;
+    os << ", ";
+    if (!writeReal(os, ii->IRange->Max))
+      return false;
+    os << ") ";
+  }
+  if (ii->IError) {
+    os << "error(";
+    if (!writeReal(os, *ii->IError))
+      return false;
+    os << ") ";
+  }
+  if (!ii->IEnableConversion)
+    os << "disabled ";
+  if (ii->IFinal)
+    os << "final ";
+  os << ")";
+  return true;
+}
+
+
+bool InitializerCache::writeValueInfo(raw_ostream& os, const ValueInfo& vi)
+{
+  if (!vi.metadata)
+    return false;
+  os << vi.fixpTypeRootDistance << " ";
+  if (vi.target) {
+    os << "target('";
+    for (char c: StringRef(vi.target)) {
+      if (c == '\n' || c == '\0')
+        return false;
+      if (c == '@' || c == '\'')
+        os << '@';
+      os << c;
+    }
+    os << "') ";
+  }
+  if (vi.backtrackingDepthLeft > 0)
+    os << "backtracking(" << vi.backtrackingDepthLeft << ") ";
+  return writeMDInfo(os, vi.metadata);
+}
+
+
+bool InitializerCache::readValueInfo(StringRef str, ValueInfo& vi, MDInfoStore& store)
+{
+  StringRef distance;
+  std::tie(distance, str) = str.split(' ');
+  if (distance.getAsInteger(10, vi.fixpTypeRootDistance))
+    return false;
+
+  AnnotationParser parser;
+  if (!parser.parseAnnotationString(str))
+    return false;
+  vi.metadata = store.intern(parser.metadata);
+  vi.target = parser.target.hasValue() ? store.internTarget(parser.target.getValue()) : nullptr;
+  vi.backtrackingDepthLeft = parser.backtracking ? parser.backtrackingDepth : 0;
+  return true;
+}
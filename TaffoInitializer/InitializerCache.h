@@ -0,0 +1,50 @@
+#include <memory>
+#include <string>
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "TaffoInitializerPass.h"
+#include "MDInfoStore.h"
+
+
+#ifndef __TAFFO_INITIALIZER_CACHE_H__
+#define __TAFFO_INITIALIZER_CACHE_H__
+
+
+namespace taffo {
+
+
+/* Persistent cache of propagation results, stored as one file per key in a
+ * directory. The files are named like the ones of the LLVM caches, so that
+ * llvm::pruneCache can bound the size of the directory evicting the least
+ * recently used entries. Entries are text, the ValueInfos are written in the
+ * annotation syntax and read back by the AnnotationParser. */
+class InitializerCache {
+  std::string dir;
+
+  std::string entryPath(llvm::StringRef key) const;
+
+public:
+  /* Creates the cache directory if it does not exist */
+  InitializerCache(llvm::StringRef dir);
+
+  /* Returns nullptr on a miss */
+  std::unique_ptr<llvm::MemoryBuffer> lookup(llvm::StringRef key);
+  void store(llvm::StringRef key, llvm::StringRef data);
+  /* Evicts entries according to a policy in the syntax of
+   * llvm::parseCachePruningPolicy */
+  void prune(llvm::StringRef policy);
+
+  /* Writes "<distance> <annotation>". Returns false if vi can not be
+   * expressed by an annotation. */
+  static bool writeValueInfo(llvm::raw_ostream& os, const ValueInfo& vi);
+  static bool writeMDInfo(llvm::raw_ostream& os, const mdutils::MDInfo *mdi);
+  /* Parses the output of writeValueInfo, interning the metadata in store */
+  static bool readValueInfo(llvm::StringRef str, ValueInfo& vi, MDInfoStore& store);
+};
+
+
+}
+
+
+#endif // __TAFFO_INITIALIZER_CACHE_H__
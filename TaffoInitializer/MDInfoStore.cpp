@@ -0,0 +1,224 @@
+#include <algorithm>
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
+#include "TaffoInitializerPass.h"
+#include "MDInfoStore.h"
+
+
+using namespace llvm;
+using namespace taffo;
+using namespace mdutils;
+
+
+namespace {
+
+/* Allocator of the interned objects (and of their reference counts) in the
+ * arena of the store. The memory is only released with the arena. */
+template <typename T>
+struct ArenaAllocator {
+  using value_type = T;
+  BumpPtrAllocator *arena;
+
+  ArenaAllocator(BumpPtrAllocator& arena): arena(&arena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other): arena(other.arena) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(arena->Allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *, size_t) {}
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+}
+
+
+MDInfo *MDInfoStore::intern(const MDInfoPtr& mdi)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return internLocked(mdi).get();
+}
+
+
+const char *MDInfoStore::internTarget(StringRef name)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return targets.save(name).data();
+}
+
+
+MDInfoStore::MDInfoPtr MDInfoStore::allocate(const MDInfo *mdi)
+{
+  ArenaAllocator<char> alloc(arena);
+  if (const StructInfo *si = dyn_cast<StructInfo>(mdi))
+    return std::allocate_shared<StructInfo>(alloc, *si);
+  return std::allocate_shared<InputInfo>(alloc, *cast<InputInfo>(mdi));
+}
+
+
+MDInfoStore::MDInfoPtr MDInfoStore::internLocked(const MDInfoPtr& mdi)
+{
+  if (!mdi)
+    return nullptr;
+  auto known = interned.find(mdi.get());
+  if (known != interned.end()) {
+    MDInfoShared++;
+    return known->second;
+  }
+
+  /* the fields of a struct are interned first, so that the metadata
+   * extracted from an interned struct is interned as well */
+  MDInfoPtr canonical = mdi;
+  if (StructInfo *si = dyn_cast<StructInfo>(mdi.get())) {
+    std::vector<MDInfoPtr> fields;
+    bool changed = false;
+    for (unsigned i = 0; i < si->size(); i++) {
+      MDInfoPtr field = si->getField(i);
+      MDInfoPtr internedField = internLocked(field);
+      changed |= internedField != field;
+      fields.push_back(internedField);
+    }
+    if (changed)
+      canonical.reset(new StructInfo(fields));
+  }
+
+  SmallString<128> key;
+  raw_svector_ostream os(key);
+  encode(os, canonical.get());
+  auto res = uniqued.insert(std::make_pair(key, nullptr));
+  if (res.second) {
+    res.first->second = allocate(canonical.get());
+    MDInfoAllocated++;
+  } else {
+    MDInfoShared++;
+  }
+  canonical = res.first->second;
+  interned[canonical.get()] = canonical;
+  return canonical;
+}
+
+
+MDInfo *MDInfoStore::withConversionEnabled(MDInfo *mdi)
+{
+  InputInfo *ii = cast<InputInfo>(mdi);
+  if (ii->IEnableConversion)
+    return mdi;
+
+  std::lock_guard<std::mutex> guard(lock);
+  auto known = enabledCopies.find(mdi);
+  if (known != enabledCopies.end()) {
+    MDInfoShared++;
+    return known->second;
+  }
+  InputInfo *copy = cast<InputInfo>(ii->clone());
+  MDInfoCloned++;
+  copy->IEnableConversion = true;
+  MDInfo *res = internLocked(MDInfoPtr(copy)).get();
+  enabledCopies[mdi] = res;
+  return res;
+}
+
+
+MDInfo *MDInfoStore::join(MDInfo *a, MDInfo *b)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return joinLocked(a, b).get();
+}
+
+
+MDInfoStore::MDInfoPtr MDInfoStore::joinLocked(MDInfo *a, MDInfo *b)
+{
+  if (!a || a == b)
+    return b ? interned.lookup(b) : nullptr;
+  if (!b)
+    return interned.lookup(a);
+  auto known = joins.find({a, b});
+  if (known != joins.end())
+    return interned.lookup(known->second);
+
+  MDInfoPtr res;
+  StructInfo *sa = dyn_cast<StructInfo>(a);
+  StructInfo *sb = dyn_cast<StructInfo>(b);
+  if (sa && sb && sa->size() == sb->size()) {
+    std::vector<MDInfoPtr> fields;
+    for (unsigned i = 0; i < sa->size(); i++)
+      fields.push_back(joinLocked(sa->getField(i).get(), sb->getField(i).get()));
+    res = internLocked(MDInfoPtr(new StructInfo(fields)));
+  } else if (!sa && !sb) {
+    InputInfo *ia = cast<InputInfo>(a);
+    InputInfo *ib = cast<InputInfo>(b);
+    std::shared_ptr<TType> type;
+    if (ia->IType && ib->IType && ia->IType->toString() == ib->IType->toString())
+      type = ia->IType;
+    std::shared_ptr<Range> range;
+    if (ia->IRange && ib->IRange)
+      range.reset(new Range(std::min(ia->IRange->Min, ib->IRange->Min),
+                            std::max(ia->IRange->Max, ib->IRange->Max)));
+    std::shared_ptr<double> error = ia->IError;
+    if (!error || (ib->IError && *ib->IError > *error))
+      error = ib->IError;
+    InputInfo *ii = new InputInfo(nullptr, nullptr, nullptr,
+        ia->IEnableConversion || ib->IEnableConversion, ia->IFinal && ib->IFinal);
+    ii->IType = type;
+    ii->IRange = range;
+    ii->IError = error;
+    res = internLocked(MDInfoPtr(ii));
+  } else {
+    res = interned.lookup(a);
+  }
+  joins[{a, b}] = res.get();
+  return res;
+}
+
+
+MDNode *MDInfoStore::getMetadataNode(const MDInfo *mdi, LLVMContext& C)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  MDNode *&node = nodes[mdi];
+  if (node) {
+    MDNodesReused++;
+    return node;
+  }
+  node = mdi->toMetadata(C);
+  nodeBytes += sizeof(MDNode) + node->getNumOperands() * sizeof(MDOperand);
+  MDNodesBuilt++;
+  return node;
+}
+
+
+void MDInfoStore::encode(raw_ostream& os, const MDInfo *mdi)
+{
+  if (!mdi) {
+    os << "void";
+    return;
+  }
+  if (const StructInfo *si = dyn_cast<StructInfo>(mdi)) {
+    os << "struct[";
+    for (unsigned i = 0; i < si->size(); i++) {
+      encode(os, si->getField(i).get());
+      os << ",";
+    }
+    os << "]";
+    return;
+  }
+  const InputInfo *ii = cast<InputInfo>(mdi);
+  os << "scalar(";
+  if (ii->IType)
+    os << "type(" << ii->IType->toString() << ")";
+  if (ii->IRange)
+    os << "range(" << format_hex(DoubleToBits(ii->IRange->Min), 18) << ","
+       << format_hex(DoubleToBits(ii->IRange->Max), 18) << ")";
+  if (ii->IError)
+    os << "error(" << format_hex(DoubleToBits(*ii->IError), 18) << ")";
+  if (!ii->IEnableConversion)
+    os << "disabled";
+  if (ii->IFinal)
+    os << "final";
+  os << ")";
+}
+
@@ -0,0 +1,104 @@
+#include <memory>
+#include <mutex>
+#include <string>
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/StringSaver.h"
+#include "llvm/Support/raw_ostream.h"
+#include "InputInfo.h"
+
+
+#ifndef __TAFFO_MDINFO_STORE_H__
+#define __TAFFO_MDINFO_STORE_H__
+
+
+namespace taffo {
+
+
+/* Hash-consing store of the metadata of the values in the conversion queue.
+ *
+ * Structurally identical MDInfo objects are represented by a single shared
+ * object, therefore two interned objects are equal if and only if their
+ * pointers are equal. Interned objects are immutable: modified versions are
+ * obtained from the store, which creates (and uniques) a new object only the
+ * first time a given modification is requested.
+ * The interned objects and the target names are allocated in an arena owned
+ * by the store, and they are all freed at once when the store is destroyed;
+ * the users of the store only hold plain pointers to them.
+ * The store can be used concurrently from multiple threads. */
+class MDInfoStore {
+public:
+  using MDInfoPtr = std::shared_ptr<mdutils::MDInfo>;
+
+  MDInfoStore(): targets(arena) {}
+  MDInfoStore(const MDInfoStore&) = delete;
+  MDInfoStore& operator=(const MDInfoStore&) = delete;
+
+  /* Returns the interned object equal to mdi, which is not retained */
+  mdutils::MDInfo *intern(const MDInfoPtr& mdi);
+
+  /* Returns the interned version of mdi (which must be an interned
+   * InputInfo) with the conversion enabled. */
+  mdutils::MDInfo *withConversionEnabled(mdutils::MDInfo *mdi);
+
+  /* Returns the interned info which contains both a and b (interned as
+   * well): the union of the ranges, the largest error, the type only if
+   * they agree on it. A missing info is contained in any other; a and b of
+   * different shapes are not joined, and a is returned. */
+  mdutils::MDInfo *join(mdutils::MDInfo *a, mdutils::MDInfo *b);
+
+  /* Returns the interned copy of a target name, which is null terminated */
+  const char *internTarget(llvm::StringRef name);
+
+  /* Returns the metadata node of the interned object mdi. The node is built
+   * once, and then shared by all the values with the same info. */
+  llvm::MDNode *getMetadataNode(const mdutils::MDInfo *mdi, llvm::LLVMContext& C);
+
+  /* Writes an encoding of mdi which is equal for two MDInfo objects if and
+   * only if they are structurally equal. */
+  static void encode(llvm::raw_ostream& os, const mdutils::MDInfo *mdi);
+
+  size_t size() {
+    std::lock_guard<std::mutex> guard(lock);
+    return uniqued.size();
+  }
+  size_t getArenaSize() {
+    std::lock_guard<std::mutex> guard(lock);
+    return arena.getTotalMemory();
+  }
+  size_t getNodeCount() {
+    std::lock_guard<std::mutex> guard(lock);
+    return nodes.size();
+  }
+  /* estimate of the memory used by the nodes built by the store */
+  size_t getNodeBytes() {
+    std::lock_guard<std::mutex> guard(lock);
+    return nodeBytes;
+  }
+
+private:
+  MDInfoPtr internLocked(const MDInfoPtr& mdi);
+  MDInfoPtr allocate(const mdutils::MDInfo *mdi);
+  MDInfoPtr joinLocked(mdutils::MDInfo *a, mdutils::MDInfo *b);
+
+  std::mutex lock;
+  llvm::BumpPtrAllocator arena;
+  llvm::UniqueStringSaver targets;
+  /* the owners of the interned objects, which are in the arena */
+  llvm::StringMap<MDInfoPtr> uniqued;
+  llvm::DenseMap<mdutils::MDInfo *, MDInfoPtr> interned;
+  llvm::DenseMap<mdutils::MDInfo *, mdutils::MDInfo *> enabledCopies;
+  llvm::DenseMap<std::pair<mdutils::MDInfo *, mdutils::MDInfo *>, mdutils::MDInfo *> joins;
+  llvm::DenseMap<const mdutils::MDInfo *, llvm::MDNode *> nodes;
+  size_t nodeBytes = 0;
+};
+
+
+}
+
+
+#endif // __TAFFO_MDINFO_STORE_H__
@@ -0,0 +1,158 @@
+#include <algorithm>
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Process.h"
+#include "MemoryAccounting.h"
+
+
+using namespace llvm;
+using namespace taffo;
+
+
+MemoryAccounting::MemoryAccounting(bool sampleMalloc): sampleMalloc(sampleMalloc)
+{
+  if (sampleMalloc)
+    mallocPeak = sys::Process::GetMallocUsage();
+}
+
+
+void MemoryAccounting::set(Category c, uint64_t count, uint64_t bytes)
+{
+  current[c].count = count;
+  current[c].bytes = bytes;
+  updatePeaks(c);
+}
+
+
+void MemoryAccounting::add(Category c, int64_t count, int64_t bytes)
+{
+  current[c].count += count;
+  current[c].bytes += bytes;
+  updatePeaks(c);
+}
+
+
+void MemoryAccounting::updatePeaks(Category c)
+{
+  uint64_t total = 0;
+  for (const Usage& U: current)
+    total += U.bytes;
+
+  peak[c].count = std::max(peak[c].count, current[c].count);
+  peak[c].bytes = std::max(peak[c].bytes, current[c].bytes);
+  peakBytes = std::max(peakBytes, total);
+  for (size_t i: openPhases) {
+    Phase& P = phases[i];
+    P.peak[c].count = std::max(P.peak[c].count, current[c].count);
+    P.peak[c].bytes = std::max(P.peak[c].bytes, current[c].bytes);
+    P.peakBytes = std::max(P.peakBytes, total);
+  }
+}
+
+
+void MemoryAccounting::beginPhase(StringRef name)
+{
+  Phase P;
+  P.name = name.str();
+  if (sampleMalloc)
+    P.mallocStart = sys::Process::GetMallocUsage();
+  /* what is already allocated is part of the high-water mark of the phase */
+  uint64_t total = 0;
+  for (unsigned c = 0; c < NumCategories; c++) {
+    P.peak[c] = current[c];
+    total += current[c].bytes;
+  }
+  P.peakBytes = total;
+  mallocPeak = std::max(mallocPeak, P.mallocStart);
+  openPhases.push_back(phases.size());
+  phases.push_back(std::move(P));
+}
+
+
+void MemoryAccounting::endPhase()
+{
+  assert(!openPhases.empty() && "no phase to end");
+  Phase& P = phases[openPhases.back()];
+  openPhases.pop_back();
+  if (!sampleMalloc)
+    return;
+  P.mallocEnd = sys::Process::GetMallocUsage();
+  mallocPeak = std::max(mallocPeak, P.mallocEnd);
+}
+
+
+const char *MemoryAccounting::getCategoryName(Category c)
+{
+  switch (c) {
+  case QueueEntries:
+    return "queue_entries";
+  case MDInfoObjects:
+    return "mdinfo_objects";
+  case CloneIR:
+    return "clone_ir";
+  case MetadataNodes:
+    return "metadata_nodes";
+  default:
+    llvm_unreachable("unknown memory category");
+  }
+}
+
+
+bool MemoryAccounting::isMeasured(Category c)
+{
+  return c == MDInfoObjects;
+}
+
+
+uint64_t MemoryAccounting::estimateIRSize(const Function& f)
+{
+  uint64_t res = 0;
+  for (const Instruction& I: instructions(f))
+    res += sizeof(Instruction) + I.getNumOperands() * sizeof(Use);
+  return res;
+}
+
+
+void MemoryAccounting::writeReport(raw_ostream& os, StringRef module) const
+{
+  auto usage = [](unsigned c, const Usage& U) -> json::Value {
+    bool measured = isMeasured(static_cast<Category>(c));
+    return json::Object{
+      {"count", static_cast<int64_t>(U.count)},
+      {measured ? "allocated_bytes" : "estimated_bytes", static_cast<int64_t>(U.bytes)}};
+  };
+
+  json::Object categories;
+  for (unsigned c = 0; c < NumCategories; c++) {
+    categories[getCategoryName(static_cast<Category>(c))] = json::Object{
+      {"final", usage(c, current[c])},
+      {"peak", usage(c, peak[c])}};
+  }
+
+  json::Array phaseList;
+  for (const Phase& P: phases) {
+    json::Object peaks;
+    for (unsigned c = 0; c < NumCategories; c++)
+      peaks[getCategoryName(static_cast<Category>(c))] = usage(c, P.peak[c]);
+    json::Object phase{
+      {"name", P.name},
+      {"estimated_peak_bytes", static_cast<int64_t>(P.peakBytes)},
+      {"peak", std::move(peaks)}};
+    if (sampleMalloc) {
+      phase["malloc_start_bytes"] = static_cast<int64_t>(P.mallocStart);
+      phase["malloc_end_bytes"] = static_cast<int64_t>(P.mallocEnd);
+    }
+    phaseList.push_back(std::move(phase));
+  }
+
+  json::Object report{
+    {"module", module},
+    {"estimated_peak_bytes", static_cast<int64_t>(peakBytes)},
+    {"categories", std::move(categories)},
+    {"phases", std::move(phaseList)}};
+  if (sampleMalloc)
+    report["malloc_peak_bytes"] = static_cast<int64_t>(mallocPeak);
+  os << formatv("{0:2}", json::Value(std::move(report))) << "\n";
+}
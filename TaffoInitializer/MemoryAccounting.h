@@ -0,0 +1,87 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/raw_ostream.h"
+
+
+#ifndef __TAFFO_MEMORY_ACCOUNTING_H__
+#define __TAFFO_MEMORY_ACCOUNTING_H__
+
+
+namespace taffo {
+
+
+/* Accounting of the memory used by the initializer, enabled by
+ * -taffo-init-memory-report.
+ * The size of each category is sampled by the pass. The MDInfo objects are
+ * measured, as the memory allocated by the arena of the store, the other
+ * categories are estimated from the number of elements they hold and are not
+ * a count of the actual allocations. The report names the sizes accordingly
+ * (allocated_bytes or estimated_bytes), and the totals, which add both, are
+ * estimates. The high-water marks are tracked for the whole run and
+ * for each phase, together with the heap usage reported by malloc at the
+ * boundaries of the phases. The malloc usage is that of the whole process:
+ * it is not sampled, and not reported, when other modules are processed
+ * concurrently in the same process. The samples are taken from the serial
+ * parts of the pass only, the accounting is not thread safe. */
+class MemoryAccounting {
+public:
+  enum Category {
+    QueueEntries,
+    MDInfoObjects,
+    CloneIR,
+    MetadataNodes,
+    NumCategories
+  };
+
+  struct Usage {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+  };
+
+  struct Phase {
+    std::string name;
+    uint64_t mallocStart = 0;
+    uint64_t mallocEnd = 0;
+    Usage peak[NumCategories];
+    uint64_t peakBytes = 0;
+  };
+
+  MemoryAccounting(bool sampleMalloc = true);
+
+  void set(Category c, uint64_t count, uint64_t bytes);
+  void add(Category c, int64_t count, int64_t bytes);
+
+  /* Phases can be nested, the samples count for all the open ones */
+  void beginPhase(llvm::StringRef name);
+  void endPhase();
+
+  void writeReport(llvm::raw_ostream& os, llvm::StringRef module) const;
+
+  static const char *getCategoryName(Category c);
+  /* Whether the size of c is measured from its allocator */
+  static bool isMeasured(Category c);
+  /* Estimate of the memory used by the instructions of f, from their number
+   * of operands only: the operand bundles, the metadata attachments, the
+   * names of the values and the basic blocks are not counted */
+  static uint64_t estimateIRSize(const llvm::Function& f);
+
+private:
+  void updatePeaks(Category c);
+
+  bool sampleMalloc;
+  Usage current[NumCategories];
+  Usage peak[NumCategories];
+  uint64_t peakBytes = 0;
+  uint64_t mallocPeak = 0;
+  std::vector<Phase> phases;
+  std::vector<size_t> openPhases;
+};
+
+
+}
+
+
+#endif // __TAFFO_MEMORY_ACCOUNTING_H__
@@ -0,0 +1,149 @@
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/MemoryBuiltins.h"
+#include "llvm/IR/Module.h"
+#include "MemoryDependences.h"
+
+
+using namespace llvm;
+using namespace taffo;
+
+
+constexpr unsigned int MemoryDependences::WalkLimit;
+
+
+MemoryDependences::MemoryDependences(Function &F, const TargetLibraryInfoImpl& TLII)
+{
+  DominatorTree DT(F);
+  AssumptionCache AC(F);
+  TargetLibraryInfo TLI(TLII);
+  BasicAAResult BasicAA(F.getParent()->getDataLayout(), F, TLI, AC, &DT);
+  AAResults AA(TLI);
+  AA.addAAResult(BasicAA);
+  MemorySSA MSSA(F, &AA, &DT);
+  compute(F, AA, MSSA, TLI);
+}
+
+
+MemoryDependences::MemoryDependences(Function &F, AAResults &AA, MemorySSA &MSSA, const TargetLibraryInfo &TLI)
+{
+  compute(F, AA, MSSA, TLI);
+}
+
+
+void MemoryDependences::compute(Function &F, AAResults &AA, MemorySSA &MSSA, const TargetLibraryInfo &TLI)
+{
+  for (BasicBlock& BB: F) {
+    for (Instruction& I: BB) {
+      StoreInst *store = dyn_cast<StoreInst>(&I);
+      if (!store)
+        continue;
+      SmallVector<LoadInst *, 4> reached;
+      computeReachedLoads(F, AA, MSSA, store, reached);
+      if (!reached.empty())
+        readers[store] = std::move(reached);
+
+      SmallVector<Instruction *, 4> chain;
+      Value *v = store->getValueOperand();
+      while (CastInst *cast = dyn_cast<CastInst>(v)) {
+        chain.push_back(cast);
+        v = cast->getOperand(0);
+      }
+      CallBase *call = dyn_cast<CallBase>(v);
+      if (call && isAllocationFn(call, &TLI)) {
+        chain.push_back(call);
+        allocations[store] = std::move(chain);
+      }
+    }
+  }
+}
+
+
+ArrayRef<LoadInst *> MemoryDependences::getReachedLoads(StoreInst *store) const
+{
+  auto R = readers.find(store);
+  if (R == readers.end())
+    return None;
+  return R->second;
+}
+
+
+bool MemoryDependences::getStoredAllocation(StoreInst *store, SmallVectorImpl<Instruction *>& chain) const
+{
+  auto A = allocations.find(store);
+  if (A == allocations.end())
+    return false;
+  chain.append(A->second.begin(), A->second.end());
+  return true;
+}
+
+
+/* The loads are found walking the defs reached from the store: a load may
+ * read the store if it uses one of them and the locations may alias. The
+ * clobbering access of the load is not enough, because it is the first def
+ * which may alias the load, and a store which may write the same location
+ * (a[j] after a[i]) does not hide the value of a[i]. The walk stops at the
+ * stores which overwrite the whole location. When the walk is longer than
+ * WalkLimit, the loads which may alias the store are returned instead. */
+void MemoryDependences::computeReachedLoads(Function &F, AAResults &AA, MemorySSA &MSSA,
+    StoreInst *store, SmallVectorImpl<LoadInst *>& res)
+{
+  MemoryAccess *def = MSSA.getMemoryAccess(store);
+  if (!def)
+    return;
+  MemoryLocation storeLoc = MemoryLocation::get(store);
+
+  SmallPtrSet<MemoryAccess *, 16> reached;
+  SmallPtrSet<LoadInst *, 16> found;
+  SmallVector<MemoryAccess *, 16> worklist;
+  reached.insert(def);
+  worklist.push_back(def);
+  while (!worklist.empty()) {
+    if (reached.size() > WalkLimit) {
+      res.clear();
+      getMayAliasLoads(F, AA, storeLoc, res);
+      return;
+    }
+    MemoryAccess *MA = worklist.pop_back_val();
+    for (User *U: MA->users()) {
+      if (MemoryUse *use = dyn_cast<MemoryUse>(U)) {
+        LoadInst *load = dyn_cast_or_null<LoadInst>(use->getMemoryInst());
+        if (load && !found.count(load)
+            && AA.alias(MemoryLocation::get(load), storeLoc) != AliasResult::NoAlias) {
+          found.insert(load);
+          res.push_back(load);
+        }
+        continue;
+      }
+      MemoryAccess *next = dyn_cast<MemoryAccess>(U);
+      if (!next || !reached.insert(next).second)
+        continue;
+      if (MemoryDef *nextDef = dyn_cast<MemoryDef>(next)) {
+        StoreInst *kill = dyn_cast_or_null<StoreInst>(nextDef->getMemoryInst());
+        if (kill && kill->getValueOperand()->getType() == store->getValueOperand()->getType()
+            && AA.alias(MemoryLocation::get(kill), storeLoc) == AliasResult::MustAlias)
+          continue;
+      }
+      worklist.push_back(next);
+    }
+  }
+}
+
+
+/* Adds to res the loads of the function which may read loc */
+void MemoryDependences::getMayAliasLoads(Function &F, AAResults &AA, const MemoryLocation& loc,
+    SmallVectorImpl<LoadInst *>& res)
+{
+  if (!loadsCollected) {
+    for (BasicBlock& BB: F) {
+      for (Instruction& I: BB) {
+        if (LoadInst *load = dyn_cast<LoadInst>(&I))
+          loads.push_back(load);
+      }
+    }
+    loadsCollected = true;
+  }
+  for (LoadInst *load: loads) {
+    if (AA.alias(MemoryLocation::get(load), loc) != AliasResult::NoAlias)
+      res.push_back(load);
+  }
+}
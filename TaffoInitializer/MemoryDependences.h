@@ -0,0 +1,68 @@
+#include <memory>
+#include <vector>
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/BasicAliasAnalysis.h"
+#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+
+
+#ifndef __TAFFO_MEMORY_DEPENDENCES_H__
+#define __TAFFO_MEMORY_DEPENDENCES_H__
+
+
+namespace taffo {
+
+
+/* Memory dependences of the loads and stores of a function, computed with
+ * MemorySSA on top of alias analysis. The analyses are either built by the
+ * instance, with basic alias analysis only, or taken from the analysis
+ * manager of the new pass manager.
+ * The dependences of every store are computed by the constructor, and the
+ * queries only read them: the analyses, and the DataLayout of the module
+ * which they fill lazily, are never used concurrently. The instances must be
+ * constructed serially, and then they can be queried concurrently. */
+class MemoryDependences {
+  llvm::DenseMap<llvm::StoreInst *, llvm::SmallVector<llvm::LoadInst *, 4>> readers;
+  /* the chain of the stores of the result of an allocation call */
+  llvm::DenseMap<llvm::StoreInst *, llvm::SmallVector<llvm::Instruction *, 4>> allocations;
+  /* all the loads of the function, collected on the first walk which
+   * exceeds WalkLimit */
+  std::vector<llvm::LoadInst *> loads;
+  bool loadsCollected = false;
+
+  void compute(llvm::Function &F, llvm::AAResults &AA, llvm::MemorySSA &MSSA, const llvm::TargetLibraryInfo &TLI);
+  void computeReachedLoads(llvm::Function &F, llvm::AAResults &AA, llvm::MemorySSA &MSSA,
+                           llvm::StoreInst *store, llvm::SmallVectorImpl<llvm::LoadInst *>& res);
+  void getMayAliasLoads(llvm::Function &F, llvm::AAResults &AA, const llvm::MemoryLocation& loc,
+                        llvm::SmallVectorImpl<llvm::LoadInst *>& res);
+
+public:
+  /* Maximum number of memory accesses walked from a store. Past it, every
+   * load which may alias the store is assumed to read it, otherwise the walks
+   * from all the stores would be quadratic in the size of MemorySSA. */
+  static constexpr unsigned int WalkLimit = 1000;
+
+  /* Builds the analyses, and releases them once the dependences are known */
+  MemoryDependences(llvm::Function &F, const llvm::TargetLibraryInfoImpl& TLII);
+  /* Uses analyses which are up to date with F */
+  MemoryDependences(llvm::Function &F, llvm::AAResults &AA, llvm::MemorySSA &MSSA, const llvm::TargetLibraryInfo &TLI);
+
+  /* Loads which may read the value written by store */
+  llvm::ArrayRef<llvm::LoadInst *> getReachedLoads(llvm::StoreInst *store) const;
+
+  /* If store writes the result of an allocation call, adds to chain the
+   * casts between the call and the store (starting from the stored value)
+   * followed by the call itself. */
+  bool getStoredAllocation(llvm::StoreInst *store, llvm::SmallVectorImpl<llvm::Instruction *>& chain) const;
+};
+
+
+}
+
+
+#endif // __TAFFO_MEMORY_DEPENDENCES_H__
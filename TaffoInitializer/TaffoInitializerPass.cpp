@@ -1,5 +1,8 @@
 #include <cmath>
 #include <climits>
+#include <algorithm>
+#include <deque>
+#include <memory>
 #include "llvm/Pass.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Constants.h"
@@ -7,16 +10,34 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/ModuleSlotTracker.h"
+#include "llvm/IR/TypeFinder.h"
+#include "llvm/Passes/PassBuilder.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/MemorySSA.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 #include <llvm/Transforms/Utils/ValueMapper.h>
 #include <llvm/Transforms/Utils/Cloning.h>
 #include "TaffoInitializerPass.h"
+#include "InitializerCache.h"
+#include "AnnotationSummary.h"
+#include "MemoryDependences.h"
 #include "TypeUtils.h"
 #include "Metadata.h"
 
@@ -34,19 +55,240 @@ static RegisterPass<TaffoInitializer> X(
   true /* Optimization Pass (sorta) */);
 
 
+PassPluginLibraryInfo taffo::getTaffoInitializerPluginInfo()
+{
+  return {LLVM_PLUGIN_API_VERSION, "TaffoInitializer", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            /* the passes and the analysis registered with the same builder
+             * share the result */
+            auto holder = std::make_shared<InitializerResultHolder>();
+            PB.registerAnalysisRegistrationCallback(
+                [holder](ModuleAnalysisManager &MAM) {
+                  MAM.registerPass([holder]() { return InitializerAnalysis(holder); });
+                });
+            PB.registerPipelineParsingCallback(
+                [holder](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "taffoinit") {
+                    MPM.addPass(TaffoInitializerPass(holder));
+                    return true;
+                  }
+                  return false;
+                });
+          }};
+}
+
+
+/* Entry point for opt -load-pass-plugin. Weak, in order not to clash with
+ * the one of a plugin which bundles all the TAFFO passes. */
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo()
+{
+  return getTaffoInitializerPluginInfo();
+}
+
+
 llvm::cl::opt<bool> ManualFunctionCloning("manualclone",
     llvm::cl::desc("Enables function cloning only for annotated functions"), llvm::cl::init(false));
+llvm::cl::opt<bool> EmitMetadata("taffo-init-metadata",
+    llvm::cl::desc("Attach the computed info to the IR as metadata (the in-memory result is always available)"),
+    llvm::cl::init(true));
+llvm::cl::opt<unsigned> InitThreads("taffo-init-threads",
+    llvm::cl::desc("Number of threads used for annotation parsing and propagation (0 = one per core)"),
+    llvm::cl::init(1));
+llvm::cl::opt<bool> RemoveDeadFunctions("taffo-init-remove-dead",
+    llvm::cl::desc("Remove the internal functions which are not referenced anymore after cloning"),
+    llvm::cl::init(false));
+llvm::cl::opt<bool> MemoryPropagation("taffo-init-memssa",
+    llvm::cl::desc("Propagate from the stores to the loads which read them, found with MemorySSA, "
+                   "instead of backtracking the stores of pointers to float"),
+    llvm::cl::init(false));
+llvm::cl::opt<bool> FloatPruning("taffo-init-float-pruning",
+    llvm::cl::desc("Do not propagate to the instructions which neither produce nor use floating point data"),
+    llvm::cl::init(false));
+llvm::cl::opt<std::string> InitCacheDir("taffo-init-cache-dir",
+    llvm::cl::desc("Directory of the persistent cache of the propagation results (disabled if empty)"),
+    llvm::cl::init(""));
+llvm::cl::opt<std::string> InitCachePolicy("taffo-init-cache-policy",
+    llvm::cl::desc("Pruning policy of the initializer cache, in the syntax of the ThinLTO cache policies"),
+    llvm::cl::init("prune_interval=1m:prune_after=168h:cache_size_bytes=256m"));
+llvm::cl::opt<std::string> SummaryOut("taffo-init-summary-out",
+    llvm::cl::desc("Write the summary of the info exported by the module to this file"),
+    llvm::cl::init(""));
+llvm::cl::list<std::string> SummaryIn("taffo-init-summary-in",
+    llvm::cl::desc("Summaries of the other modules of the program, merged and imported"),
+    llvm::cl::CommaSeparated);
+llvm::cl::opt<std::string> MemoryReport("taffo-init-memory-report",
+    llvm::cl::desc("Write a JSON report of the memory used by the initializer, by category and by phase, to this file"),
+    llvm::cl::init(""));
+
+
+unsigned int TaffoInitializer::getThreadCount()
+{
+#ifndef NDEBUG
+  /* keep the debug output readable */
+  if (DebugFlag)
+    return 1;
+#endif
+  if (InitThreads == 0)
+    return heavyweight_hardware_concurrency();
+  return InitThreads;
+}
+
+
+namespace {
+
+/* Times a phase of the pass. The time is reported with -time-passes, and the
+ * phase is recorded in the time trace when it is enabled (-ftime-trace). */
+class PhaseTimer {
+  NamedRegionTimer timer;
+  TimeTraceScope trace;
+  MemoryAccounting *accounting;
+
+public:
+  PhaseTimer(MemoryAccounting *accounting, StringRef name, StringRef description, StringRef detail = ""):
+      timer(name, description, "taffoinit", "TAFFO Initializer", TimePassesIsEnabled),
+      trace(description, detail), accounting(accounting) {
+    if (accounting)
+      accounting->beginPhase(name);
+  }
+  ~PhaseTimer() {
+    if (accounting)
+      accounting->endPhase();
+  }
+};
+
+}
+
+
+TaffoInitializer::TaffoInitializer(): ModulePass(ID),
+    summaryOutPath(SummaryOut), memoryReportPath(MemoryReport) { }
+
+
+TaffoInitializer::~TaffoInitializer() = default;
+
+
+void TaffoInitializer::getAnalysisUsage(AnalysisUsage &AU) const
+{
+  AU.addRequired<CallGraphWrapperPass>();
+  /* clones are new functions, the CFG of the existing ones is untouched */
+  AU.setPreservesCFG();
+}
 
 
 bool TaffoInitializer::runOnModule(Module &m)
 {
+  CallGraph &cg = getAnalysis<CallGraphWrapperPass>().getCallGraph();
+  return runOnModuleImpl(m, cg);
+}
+
+
+void TaffoInitializer::releaseMemory()
+{
+  result.clear();
+}
+
+
+AnalysisKey InitializerAnalysis::Key;
+
+
+InitializerAnalysis::Result InitializerAnalysis::run(Module &M, ModuleAnalysisManager &AM)
+{
+  return Result(holder, holder ? holder->get() : nullptr);
+}
+
+
+bool InitializerAnalysis::Result::invalidate(Module &M, const PreservedAnalyses &PA,
+                                             ModuleAnalysisManager::Invalidator &Inv)
+{
+  if (PA.getChecker<InitializerAnalysis>().preserved())
+    return false;
+  /* the result can not be recomputed without running the initializer again */
+  if (holder)
+    holder->drop(result);
+  return true;
+}
+
+
+PreservedAnalyses TaffoInitializerPass::run(Module &m, ModuleAnalysisManager &AM)
+{
+  TaffoInitializer init;
+  init.functionAnalyses = &AM.getResult<FunctionAnalysisManagerModuleProxy>(m).getManager();
+  init.runOnModuleImpl(m, AM.getResult<CallGraphAnalysis>(m));
+  if (holder) {
+    /* The cached InitializerAnalysis refers to the result of a previous run,
+     * if any. The new result is cached in its place and preserved, so that
+     * it is dropped from the holder when a later pass invalidates it: the
+     * result of an analysis which is not cached is never invalidated. */
+    PreservedAnalyses stale = PreservedAnalyses::all();
+    stale.abandon<InitializerAnalysis>();
+    AM.invalidate(m, stale);
+    holder->publish(std::move(init.result));
+    AM.getResult<InitializerAnalysis>(m);
+  }
+
+  /* Analyses do not depend on the TAFFO metadata nor on the optnone
+   * attribute. */
+  const InitializerChanges& changes = init.changes;
+  if (!changes.instructions && !changes.callGraph)
+    return PreservedAnalyses::all();
+
+  PreservedAnalyses PA;
+  PA.preserve<InitializerAnalysis>();
+  PA.preserveSet<CFGAnalyses>();
+  /* The CFG set only keeps the function analyses if the proxy is preserved
+   * as well. The results of the removed functions have been cleared. */
+  PA.preserve<FunctionAnalysisManagerModuleProxy>();
+  /* the removed annotation calls and the redirected calls are memory
+   * accesses */
+  PA.abandon<MemorySSAAnalysis>();
+  /* annotation intrinsics do not appear in the call graph */
+  if (!changes.callGraph)
+    PA.preserve<CallGraphAnalysis>();
+  return PA;
+}
+
+
+bool TaffoInitializer::runOnModuleImpl(Module &m, CallGraph &cg)
+{
+  changes = InitializerChanges();
+  clearRunState();
+  mdInfoStore = std::make_shared<MDInfoStore>();
+  if (!InitCacheDir.empty()) {
+    cache.reset(new InitializerCache(InitCacheDir));
+    computeCacheModuleKey(m);
+  }
+  if (!memoryReportPath.empty())
+    memoryAccounting.reset(new MemoryAccounting(memoryReportMalloc));
+  if (!summaryOutPath.empty())
+    summary.reset(new AnnotationSummary());
+  if (!SummaryIn.empty()) {
+    importedSummary.reset(new AnnotationSummary());
+    /* the calls bound to clones of other modules would be wrong without a
+     * part of the summary, continuing is not an option */
+    for (const std::string& path: SummaryIn) {
+      if (!importedSummary->mergeFile(path))
+        report_fatal_error("TAFFO initializer: invalid summary " + Twine(path), false);
+    }
+  }
+  if (MemoryPropagation || summary || importedSummary)
+    targetLibraryInfo.reset(new TargetLibraryInfoImpl(Triple(m.getTargetTriple())));
   DEBUG_WITH_TYPE(DEBUG_ANNOTATION, printAnnotatedObj(m));
 
   ConvQueueT local;
   ConvQueueT global;
-  readAllLocalAnnotations(m, local);
-  readGlobalAnnotations(m, global, true);
-  readGlobalAnnotations(m, global, false);
+  {
+    PhaseTimer T(memoryAccounting.get(), "readLocalAnnotations", "Read local annotations", m.getName());
+    readAllLocalAnnotations(m, local);
+    accountMemory(local);
+  }
+  {
+    PhaseTimer T(memoryAccounting.get(), "readGlobalAnnotations", "Read global annotations", m.getName());
+    readGlobalAnnotations(m, global, true);
+    readGlobalAnnotations(m, global, false);
+    if (importedSummary)
+      importSummaryRoots(m, global);
+    accountMemory(global);
+  }
   
   ConvQueueT rootsa;
   rootsa.insert(rootsa.end(), global.begin(), global.end());
@@ -54,24 +296,153 @@ bool TaffoInitializer::runOnModule(Module &m)
   AnnotationCount = rootsa.size();
 
   ConvQueueT vals;
-  buildConversionQueueForRootValues(rootsa, vals);
-  for (auto V: vals) {
-    setMetadataOfValue(V->first, V->second);
+  {
+    PhaseTimer T(memoryAccounting.get(), "buildConversionQueue", "Build the conversion queue", m.getName());
+    buildConversionQueueForRootValues(rootsa, vals);
+    accountMemory(vals);
+  }
+  {
+    PhaseTimer T(memoryAccounting.get(), "removeAnnotationCalls", "Remove annotation calls", m.getName());
+    removeAnnotationCalls(vals);
+    accountMemory(vals);
   }
-  removeAnnotationCalls(vals);
 
-  SmallPtrSet<Function*, 10> callTrace;
-  generateFunctionSpace(vals, global, callTrace);
+  {
+    PhaseTimer T(memoryAccounting.get(), "generateFunctionSpace", "Specialize called functions", m.getName());
+    generateFunctionSpace(m, cg, vals);
+    if (importedSummary)
+      importClones(m, vals);
+    accountMemory(vals);
+  }
+  if (RemoveDeadFunctions) {
+    PhaseTimer T(memoryAccounting.get(), "removeDeadFunctions", "Remove unreferenced originals and clones", m.getName());
+    removeDeadFunctions(m, vals);
+    accountMemory(vals);
+  }
 
+  ConversionQueueSize = vals.size();
   LLVM_DEBUG(printConversionQueue(vals));
-  setFunctionArgsMetadata(m, vals);
+  if (EmitMetadata) {
+    {
+      PhaseTimer T(memoryAccounting.get(), "setMetadataOfValue", "Attach metadata to the queued values", m.getName());
+      for (auto& V: vals) {
+        setMetadataOfValue(V.first, V.second);
+      }
+      accountMemory(vals);
+    }
+    {
+      PhaseTimer T(memoryAccounting.get(), "setFunctionArgsMetadata", "Attach metadata to function arguments", m.getName());
+      setFunctionArgsMetadata(m, vals);
+      accountMemory(vals);
+    }
+  }
+  exportResult(vals);
+  if (summary)
+    writeSummary(m, vals);
+  if (memoryAccounting)
+    writeMemoryReport(m);
+  if (cache)
+    cache->prune(InitCachePolicy);
+
+  clearRunState();
+  return changes.any();
+}
 
-  return true;
+
+/* Drops the state of a run. Nothing but the result and the changes outlives
+ * runOnModuleImpl, therefore separate instances can run concurrently on
+ * modules of different contexts. */
+void TaffoInitializer::clearRunState()
+{
+  enabledFunctions.clear();
+  annotationCache.clear();
+  specializations.clear();
+  sccOrder.clear();
+  createdClones.clear();
+  localAnnotationCalls.clear();
+  functionAnnotations.clear();
+  backtrackingSlicer.clear();
+  summary.reset();
+  importedSummary.reset();
+  memoryAccounting.reset();
+  cache.reset();
+  cacheModuleKey.clear();
+  targetLibraryInfo.reset();
+  /* the result keeps its own reference to the store */
+  mdInfoStore.reset();
+}
+
+
+/* Samples the size of the queue and of the metadata store */
+void TaffoInitializer::accountMemory(const ConvQueueT& queue)
+{
+  if (!memoryAccounting)
+    return;
+  memoryAccounting->set(MemoryAccounting::QueueEntries, queue.size(), queue.getMemorySize());
+  memoryAccounting->set(MemoryAccounting::MDInfoObjects, mdInfoStore->size(), mdInfoStore->getArenaSize());
+  memoryAccounting->set(MemoryAccounting::MetadataNodes, mdInfoStore->getNodeCount(), mdInfoStore->getNodeBytes());
+}
+
+
+void TaffoInitializer::writeMemoryReport(Module &m)
+{
+  std::error_code EC;
+  raw_fd_ostream os(memoryReportPath, EC, sys::fs::OF_Text);
+  if (EC) {
+    errs() << "TAFFO initializer: can not write the memory report to " << memoryReportPath
+           << ": " << EC.message() << "\n";
+    return;
+  }
+  memoryAccounting->writeReport(os, m.getModuleIdentifier());
+}
+
+
+/* Publishes the final conversion queue and the clones in result */
+void TaffoInitializer::exportResult(ConvQueueT& vals)
+{
+  result.clear();
+  result.values.reserve(vals.size());
+  for (auto& V: vals)
+    result.values.insert(std::make_pair(V.first, V.second));
+  for (auto& S: specializations) {
+    for (const FunctionSpecialization& spec: S.second) {
+      result.clones[S.first].push_back(spec.clone);
+      result.originals[spec.clone] = S.first;
+    }
+  }
+  result.backtrackingSlices = backtrackingSlicer.getSliceSizes();
+  result.store = mdInfoStore;
+  MDInfoArenaBytes += mdInfoStore->getArenaSize();
+  LLVM_DEBUG({
+    for (auto& S: result.backtrackingSlices)
+      dbgs() << "backtracking from " << *S.first << " pulled in " << S.second << " values\n";
+  });
+}
+
+
+void InitializerResult::clear()
+{
+  values.clear();
+  clones.clear();
+  originals.clear();
+  backtrackingSlices.clear();
+  store.reset();
+}
+
+
+const ValueInfo *InitializerResult::lookup(const Value *v) const
+{
+  auto I = values.find(v);
+  if (I == values.end())
+    return nullptr;
+  return &I->second;
 }
 
 
 void TaffoInitializer::removeAnnotationCalls(ConvQueueT& q)
 {
+  DenseSet<Value *> erased;
+  SmallPtrSet<Function *, 16> changed;
   for (auto i = q.begin(); i != q.end();) {
     Value *v = i->first;
     
@@ -79,7 +450,10 @@ void TaffoInitializer::removeAnnotationCalls(ConvQueueT& q)
       if (anno->getCalledFunction()) {
         if (anno->getCalledFunction()->getName() == "llvm.var.annotation") {
           i = q.erase(i);
+          erased.insert(anno);
+          changed.insert(anno->getFunction());
           anno->eraseFromParent();
+          changes.instructions = true;
           continue;
         }
       }
@@ -89,39 +463,64 @@ void TaffoInitializer::removeAnnotationCalls(ConvQueueT& q)
     
     i++;
   }
+  /* the slicer must not keep the erased calls, their addresses may be
+   * reused by the instructions of the clones */
+  backtrackingSlicer.forget(erased);
+  for (Function *f: changed)
+    invalidateFunctionAnalyses(f, false);
+}
+
+
+/* Drops the results of the analysis manager of the new pass manager which
+ * refer to the instructions removed from f, or all of them if f is about to
+ * be removed: the MemorySSA of the clones and of the later rounds must not
+ * see them, and a new function may take the address of f. */
+void TaffoInitializer::invalidateFunctionAnalyses(Function *f, bool removed)
+{
+  if (!functionAnalyses)
+    return;
+  if (removed) {
+    functionAnalyses->clear(*f, f->getName());
+    return;
+  }
+  PreservedAnalyses PA;
+  PA.preserveSet<CFGAnalyses>();
+  functionAnalyses->invalidate(*f, PA);
 }
 
 
+/* The metadata of the info is built through the MDInfoStore, so that the
+ * values with the same info share the same node */
 void TaffoInitializer::setMetadataOfValue(Value *v, ValueInfo& vi)
 {
-  std::shared_ptr<mdutils::MDInfo> md = vi.metadata;
+  mdutils::MDInfo *md = vi.metadata;
+  changes.metadata = true;
 
   if (isa<Instruction>(v) || isa<GlobalObject>(v)) {
     mdutils::MetadataManager::setInputInfoInitWeightMetadata(v, vi.fixpTypeRootDistance);
   }
 
-  if (Instruction *inst = dyn_cast<Instruction>(v)) {
-    if (vi.target.hasValue())
-      mdutils::MetadataManager::setTargetMetadata(*inst, vi.target.getValue());
+  const char *kind = nullptr;
+  if (isa_and_nonnull<mdutils::InputInfo>(md))
+    kind = INPUT_INFO_METADATA;
+  else if (isa_and_nonnull<mdutils::StructInfo>(md))
+    kind = STRUCT_INFO_METADATA;
 
-    if (mdutils::InputInfo *ii = dyn_cast<mdutils::InputInfo>(md.get())) {
-      mdutils::MetadataManager::setInputInfoMetadata(*inst, *ii);
-    } else if (mdutils::StructInfo *si = dyn_cast<mdutils::StructInfo>(md.get())) {
-      mdutils::MetadataManager::setStructInfoMetadata(*inst, *si);
-    }
+  if (Instruction *inst = dyn_cast<Instruction>(v)) {
+    if (vi.target)
+      mdutils::MetadataManager::setTargetMetadata(*inst, vi.target);
+    if (kind)
+      inst->setMetadata(kind, mdInfoStore->getMetadataNode(md, inst->getContext()));
   } else if (GlobalObject *con = dyn_cast<GlobalObject>(v)) {
-    if (vi.target.hasValue())
-      mdutils::MetadataManager::setTargetMetadata(*con, vi.target.getValue());
-
-    if (mdutils::InputInfo *ii = dyn_cast<mdutils::InputInfo>(md.get())) {
-      mdutils::MetadataManager::setInputInfoMetadata(*con, *ii);
-    } else if (mdutils::StructInfo *si = dyn_cast<mdutils::StructInfo>(md.get())) {
-      mdutils::MetadataManager::setStructInfoMetadata(*con, *si);
-    }
+    if (vi.target)
+      mdutils::MetadataManager::setTargetMetadata(*con, vi.target);
+    if (kind)
+      con->setMetadata(kind, mdInfoStore->getMetadataNode(md, con->getContext()));
   }
 }
 
 
+/* Functions whose arguments have no info are left untouched */
 void TaffoInitializer::setFunctionArgsMetadata(Module &m, ConvQueueT& Q)
 {
   std::vector<mdutils::MDInfo *> iiPVec;
@@ -131,22 +530,29 @@ void TaffoInitializer::setFunctionArgsMetadata(Module &m, ConvQueueT& Q)
     iiPVec.reserve(f.arg_size());
     wPVec.reserve(f.arg_size());
 
+    bool found = false;
     for (Argument &a : f.args()) {
-      LLVM_DEBUG(dbgs() << "Processing arg " << a << "\n");
       mdutils::MDInfo *ii = nullptr;
       int weight = -1;
-      if (Q.count(&a)) {
-        LLVM_DEBUG(dbgs() << "Info found.\n");
-        ValueInfo &vi = Q[&a];
-        ii = vi.metadata.get();
+      auto QI = Q.find(&a);
+      if (QI != Q.end()) {
+        LLVM_DEBUG(dbgs() << "Info found for arg " << a << "\n");
+        ValueInfo &vi = QI->second;
+        ii = vi.metadata;
         weight = vi.fixpTypeRootDistance;
+        found = true;
       }
       iiPVec.push_back(ii);
       wPVec.push_back(weight);
     }
 
-    mdutils::MetadataManager::setArgumentInputInfoMetadata(f, iiPVec);
-    mdutils::MetadataManager::setInputInfoInitWeightMetadata(&f, wPVec);
+    if (found) {
+      mdutils::MetadataManager::setArgumentInputInfoMetadata(f, iiPVec);
+      mdutils::MetadataManager::setInputInfoInitWeightMetadata(&f, wPVec);
+      changes.metadata = true;
+    } else {
+      FunctionArgsMetadataSkipped++;
+    }
 
     iiPVec.clear();
     wPVec.clear();
@@ -154,6 +560,147 @@ void TaffoInitializer::setFunctionArgsMetadata(Module &m, ConvQueueT& Q)
 }
 
 
+namespace {
+
+/* Snapshot of the parts of a ValueInfo which drive the propagation.
+ * A value has to be visited again only if one of them has changed. */
+struct ValueInfoState {
+  unsigned int backtrackingDepthLeft;
+  unsigned int fixpTypeRootDistance;
+  mdutils::MDInfo *metadata;
+  bool enableConversion;
+
+  ValueInfoState(const ValueInfo& vi):
+      backtrackingDepthLeft(vi.backtrackingDepthLeft),
+      fixpTypeRootDistance(vi.fixpTypeRootDistance),
+      metadata(vi.metadata)
+  {
+    mdutils::InputInfo *ii = dyn_cast_or_null<mdutils::InputInfo>(metadata);
+    enableConversion = ii && ii->IEnableConversion;
+  }
+
+  bool changedIn(const ValueInfo& vi) const {
+    ValueInfoState now(vi);
+    if (now.backtrackingDepthLeft != backtrackingDepthLeft
+        || now.fixpTypeRootDistance != fixpTypeRootDistance
+        || now.enableConversion != enableConversion)
+      return true;
+    /* metadata is interned, equal pointers mean equal contents */
+    return now.metadata != metadata;
+  }
+};
+
+
+/* FIFO of the values whose ValueInfo must be propagated again.
+ * Each value is present at most once. */
+class PropagationWorklist {
+  std::deque<Value *> queue;
+  SmallPtrSet<Value *, 8U> pending;
+
+public:
+  void push(Value *v) {
+    if (pending.insert(v).second)
+      queue.push_back(v);
+  }
+
+  Value *pop() {
+    Value *v = queue.front();
+    queue.pop_front();
+    pending.erase(v);
+    return v;
+  }
+
+  bool empty() const {
+    return queue.empty();
+  }
+
+  void clear() {
+    queue.clear();
+    pending.clear();
+  }
+};
+
+
+/* Function containing v, or nullptr for values which do not belong to any
+ * function (globals and constants). */
+Function *getOwnerFunction(Value *v)
+{
+  if (Instruction *i = dyn_cast<Instruction>(v))
+    return i->getFunction();
+  if (Argument *a = dyn_cast<Argument>(v))
+    return a->getParent();
+  return nullptr;
+}
+
+}
+
+
+namespace taffo {
+
+/* Info of a value propagated to a value which belongs to another partition.
+ * When backward is false, to is a user of from; otherwise it is one of its
+ * operands. */
+struct PropagationMessage {
+  Value *from;
+  ValueInfo fromInfo;
+  Value *to;
+  bool backward;
+  /* attribution of from in the BacktrackingSlicer of its partition */
+  Value *root = nullptr;
+  bool pulled = false;
+};
+
+
+/* Propagation state of the values which belong to the same function, or of
+ * the values which do not belong to any function when owner is nullptr.
+ * The def-use chains of a function only leave it through globals and
+ * constants, therefore the partitions of different functions never
+ * communicate directly and can be propagated concurrently. */
+struct PropagationPartition {
+  Function *owner;
+  TaffoInitializer::ConvQueueT queue;
+  PropagationWorklist worklist;
+  SmallPtrSet<Value *, 8U> visited;
+  std::vector<PropagationMessage> inbox;
+  std::vector<PropagationMessage> outbox;
+  unsigned int visitCount = 0;
+  unsigned int moveCount = 0;
+  unsigned int backtrackCount = 0;
+  unsigned int prunedCount = 0;
+  /* (phi, operand) pairs whose operand was restarted from the info of the
+   * phi by propagateBackward */
+  DenseSet<std::pair<Value *, Value *>> restartedOperands;
+  /* the values of the rounds replayed from the cache are not attributed */
+  BacktrackingSlicer slicer;
+  /* only for functions, when the propagation through memory is enabled */
+  std::unique_ptr<MemoryDependences> memory;
+  /* Instructions of owner which are not relevant to the floating point
+   * computations, and whether they were pruned already. Computed on the
+   * first use. */
+  DenseMap<const Value *, bool> floatIrrelevant;
+  bool floatIrrelevantComputed = false;
+
+  /* Key of the last round in the initializer cache, which identifies the
+   * state of the partition after it. Each round is keyed on the key of the
+   * previous one and on the messages received, the first one on the body of
+   * the function and on the roots. Rounds are no longer cached after one of
+   * them can not be expressed in terms of the function alone. */
+  std::string cacheKey;
+  bool cacheable = true;
+  /* the instructions of owner in order, referred to by index in the cache */
+  std::vector<Instruction *> instructions;
+  DenseMap<const Value *, unsigned int> instructionIndex;
+
+  PropagationPartition(Function *owner): owner(owner) {}
+
+  bool pending() const {
+    return !inbox.empty() || !worklist.empty();
+  }
+};
+
+}
+
+
 void TaffoInitializer::buildConversionQueueForRootValues(
     const ConvQueueT& val,
     ConvQueueT& queue)
@@ -164,143 +711,701 @@ void TaffoInitializer::buildConversionQueueForRootValues(
   queue.insert(queue.begin(), val.begin(), val.end());
   LLVM_DEBUG(printConversionQueue(queue));
 
-  SmallPtrSet<Value *, 8U> visited;
-  size_t prevQueueSize = 0;
-  while (prevQueueSize < queue.size()) {
-    LLVM_DEBUG(dbgs() << "***** buildConversionQueueForRootValues iter " << prevQueueSize << " < " << queue.size() << "\n";);
-    prevQueueSize = queue.size();
-
-    auto next = queue.begin();
-    while (next != queue.end()) {
-      Value *v = next->first;
-      visited.insert(v);
-      
-      LLVM_DEBUG(dbgs() << "[V] " << *v);
-      if (Instruction *i = dyn_cast<Instruction>(v))
-        LLVM_DEBUG(dbgs() << "[ " << i->getFunction()->getName() << "]\n");
-      else
-        LLVM_DEBUG(dbgs() << "\n");
-      LLVM_DEBUG(dbgs() << "    distance = " << next->second.fixpTypeRootDistance << "\n");
-
-      for (auto *u: v->users()) {
-        /* ignore u if it is the global annotation array */
-        if (GlobalObject *ugo = dyn_cast<GlobalObject>(u)) {
-          if (ugo->hasSection() && ugo->getSection() == "llvm.metadata")
-            continue;
-        }
+  /* Partitions are created in a deterministic order (the order of the roots
+   * and then of the messages) which is also the order of the final queue */
+  std::vector<std::unique_ptr<PropagationPartition>> partitions;
+  DenseMap<Function *, PropagationPartition *> partitionOf;
+  auto getPartition = [&](Function *f) -> PropagationPartition& {
+    PropagationPartition *&P = partitionOf[f];
+    if (!P) {
+      partitions.emplace_back(new PropagationPartition(f));
+      P = partitions.back().get();
+    }
+    return *P;
+  };
+  PropagationPartition& globalPart = getPartition(nullptr);
+
+  for (auto& I: queue) {
+    PropagationPartition& P = getPartition(getOwnerFunction(I.first));
+    P.queue.push_back(I.first, I.second);
+    P.worklist.push(I.first);
+    if (I.second.backtrackingDepthLeft > 0)
+      P.slicer.addRoot(I.first);
+  }
+  queue.clear();
+
+  /* The globals are propagated serially, and they dispatch their info to the
+   * partitions of the functions which use them. The partitions of the
+   * functions are then propagated concurrently, and their info about the
+   * globals is merged back serially. This is repeated until nothing changes;
+   * all the updates are monotonic, except for the restart of an operand from
+   * the info of a phi in propagateBackward, which happens at most once per
+   * pair, thus the process terminates. */
+  unsigned int threads = getThreadCount();
+  std::unique_ptr<ThreadPool> pool;
+  std::vector<PropagationPartition *> active;
+  auto dispatch = [&](PropagationPartition& P) {
+    for (PropagationMessage& M: P.outbox)
+      getPartition(getOwnerFunction(M.to)).inbox.push_back(std::move(M));
+    P.outbox.clear();
+  };
+
+  while (true) {
+    PropagationRounds++;
+    propagatePartition(globalPart);
+    dispatch(globalPart);
+
+    active.clear();
+    for (auto& P: partitions) {
+      if (P->owner && P->pending())
+        active.push_back(P.get());
+    }
+    if (active.empty())
+      break;
+
+    /* the memory dependences are computed serially, because the analyses
+     * fill the DataLayout of the module lazily; the partitions only read
+     * them */
+    for (PropagationPartition *P: active)
+      prepareFunctionPartition(*P);
+
+    if (threads <= 1 || active.size() <= 1) {
+      for (PropagationPartition *P: active) {
+        TimeTraceScope trace("Propagate function", P->owner->getName());
+        runFunctionPartition(*P);
+      }
+    } else {
+      if (!pool)
+        pool.reset(new ThreadPool(threads));
+      for (PropagationPartition *P: active)
+        pool->async([this, P]() { runFunctionPartition(*P); });
+      pool->wait();
+    }
+    for (PropagationPartition *P: active)
+      dispatch(*P);
+
+    if (memoryAccounting) {
+      size_t entries = 0, bytes = 0;
+      for (auto& P: partitions) {
+        entries += P->queue.size();
+        bytes += P->queue.getMemorySize();
+      }
+      memoryAccounting->set(MemoryAccounting::QueueEntries, entries, bytes);
+    }
+  }
 
-        if (isa<PHINode>(u) && visited.count(u)) {
-          continue;
-        }
+  unsigned int visitCount = 0;
+  for (auto& P: partitions) {
+    queue.insert(queue.end(), P->queue.begin(), P->queue.end());
+    visitCount += P->visitCount;
+    finishPartition(*P);
+  }
 
-        /* Insert u at the end of the queue.
-         * If u exists already in the queue, *move* it to the end instead. */
-        auto UI = queue.find(u);
-        ValueInfo UVInfo;
-        if (UI != queue.end()) {
-          UVInfo = UI->second;
-          queue.erase(UI);
-        }
-        UI = queue.push_back(u, std::move(UVInfo)).first;
-        LLVM_DEBUG(dbgs() << "[U] " << *u);
-        if (Instruction *i = dyn_cast<Instruction>(u))
-          LLVM_DEBUG(dbgs() << "[ " << i->getFunction()->getName() << "]\n");
-        else
-          LLVM_DEBUG(dbgs() << "\n");
-
-        unsigned int vdepth = std::min(next->second.backtrackingDepthLeft, next->second.backtrackingDepthLeft - 1);
-        if (vdepth < 2 && isa<StoreInst>(u)) {
-          StoreInst *store = dyn_cast<StoreInst>(u);
-          Value *valOp = store->getValueOperand();
-          Type *valueType = valOp->getType();
-          if (isa<BitCastInst>(valOp)
-              && valueType->isPointerTy()
-              && valueType->getPointerElementType()->isFloatingPointTy()) {
-            LLVM_DEBUG(dbgs() << "MALLOC'D POINTER HACK\n");
-            vdepth = 2;
-          }
-        }
-        if (vdepth > 0) {
-          unsigned int udepth = UI->second.backtrackingDepthLeft;
-          UI->second.backtrackingDepthLeft = std::max(vdepth, udepth);
-        }
-        createInfoOfUser(v, next->second, u, UI->second);
+  LLVM_DEBUG(dbgs() << "visited " << visitCount << " values in " << partitions.size()
+             << " partitions, queue size " << queue.size() << "\n");
+  LLVM_DEBUG(dbgs() << "***** end " << __PRETTY_FUNCTION__ << "\n");
+}
+
+
+/* Propagates the roots of the clone f within f only.
+ * The info of the globals does not depend on the clone: the users of the
+ * globals in f receive the info which the globals have in vals, and the info
+ * backtracked from f to the globals is dropped. Therefore the cost of a clone
+ * depends on its size, and not on the size of the module. */
+void TaffoInitializer::buildConversionQueueForClone(Function *f,
+    const ConvQueueT& roots, const ConvQueueT& vals, ConvQueueT& queue)
+{
+  PropagationPartition P(f);
+  for (auto& I: roots) {
+    assert(getOwnerFunction(I.first) == f && "root of a clone outside of it");
+    P.queue.push_back(I.first, I.second);
+    P.worklist.push(I.first);
+    if (I.second.backtrackingDepthLeft > 0)
+      P.slicer.addRoot(I.first);
+  }
+  for (Instruction& I: instructions(f)) {
+    for (Value *op: I.operands()) {
+      if (getOwnerFunction(op))
+        continue;
+      auto G = vals.find(op);
+      if (G != vals.end())
+        P.inbox.push_back({op, G->second, &I, false});
+    }
+  }
+
+  PropagationRounds++;
+  prepareFunctionPartition(P);
+  runFunctionPartition(P);
+  P.outbox.clear();
+
+  queue = std::move(P.queue);
+  finishPartition(P);
+  LLVM_DEBUG(dbgs() << "visited " << P.visitCount << " values in clone " << f->getName()
+             << ", queue size " << queue.size() << "\n");
+}
+
+
+void TaffoInitializer::prepareFunctionPartition(PropagationPartition& P)
+{
+  if (!MemoryPropagation || P.memory)
+    return;
+  Function &F = *P.owner;
+  if (functionAnalyses) {
+    P.memory.reset(new MemoryDependences(F, functionAnalyses->getResult<AAManager>(F),
+        functionAnalyses->getResult<MemorySSAAnalysis>(F).getMSSA(),
+        functionAnalyses->getResult<TargetLibraryAnalysis>(F)));
+  } else {
+    P.memory.reset(new MemoryDependences(F, *targetLibraryInfo));
+  }
+}
+
+
+void TaffoInitializer::runFunctionPartition(PropagationPartition& P)
+{
+  if (!replayPartition(P)) {
+    propagatePartition(P);
+    storePartition(P);
+  }
+}
+
+
+/* Collects the statistics of a partition whose propagation is over */
+void TaffoInitializer::finishPartition(PropagationPartition& P)
+{
+  PropagationVisits += P.visitCount;
+  PropagationQueueMoves += P.moveCount;
+  BacktrackingEnqueues += P.backtrackCount;
+  FloatIrrelevantPruned += P.prunedCount;
+  backtrackingSlicer.merge(P.slicer);
+}
+
+
+/* Hashes the definitions of the struct types of the module, which are used
+ * by the functions but do not appear in their body, and the data layout and
+ * the target, on which the alias analysis and the allocation functions of
+ * the propagation through memory depend. */
+void TaffoInitializer::computeCacheModuleKey(Module &m)
+{
+  std::string text;
+  raw_string_ostream os(text);
+  os << "taffoinit-cache-3\n";
+  os << "memssa=" << MemoryPropagation << " float-pruning=" << FloatPruning << "\n";
+  os << "datalayout=" << m.getDataLayoutStr() << "\n";
+  os << "triple=" << m.getTargetTriple() << "\n";
+  TypeFinder types;
+  types.run(m, /* onlyNamed */ false);
+  for (StructType *st: types) {
+    os << *st << " =";
+    if (st->isOpaque())
+      os << " opaque";
+    for (Type *field: st->elements())
+      os << " " << *field;
+    os << "\n";
+  }
+  os.flush();
+
+  MD5 hash;
+  hash.update(text);
+  MD5::MD5Result res;
+  hash.final(res);
+  cacheModuleKey = std::string(res.digest().str());
+}
+
+
+namespace {
+
+/* Types can be relied upon: the values which carry or address floating point
+ * data have a float type, or they are computed from values of float type */
+bool isFloatRelevant(const Instruction& I)
+{
+  if (isFloatType(I.getType()))
+    return true;
+  for (const Value *op: I.operands()) {
+    if (isFloatType(op->getType()))
+      return true;
+  }
+  return false;
+}
+
+
+/* Returns true if u must not be enqueued by the forward propagation */
+bool pruneFloatIrrelevant(PropagationPartition& P, Value *u)
+{
+  if (!P.floatIrrelevantComputed) {
+    for (Instruction& I: instructions(P.owner)) {
+      if (!isFloatRelevant(I))
+        P.floatIrrelevant[&I] = false;
+    }
+    P.floatIrrelevantComputed = true;
+  }
+  auto I = P.floatIrrelevant.find(u);
+  if (I == P.floatIrrelevant.end())
+    return false;
+  if (!I->second) {
+    I->second = true;
+    P.prunedCount++;
+  }
+  return true;
+}
+
+
+void indexPartition(PropagationPartition& P)
+{
+  for (Instruction& I: instructions(P.owner)) {
+    P.instructionIndex[&I] = P.instructions.size();
+    P.instructions.push_back(&I);
+  }
+}
+
+
+/* Writes a reference to an argument ("a<n>") or an instruction ("i<n>") of
+ * the function of P. */
+bool writeValueRef(raw_ostream& os, const PropagationPartition& P, const Value *v)
+{
+  if (const Argument *a = dyn_cast<Argument>(v)) {
+    os << "a" << a->getArgNo();
+    return true;
+  }
+  auto I = P.instructionIndex.find(v);
+  if (I == P.instructionIndex.end())
+    return false;
+  os << "i" << I->second;
+  return true;
+}
+
+
+Value *readValueRef(const PropagationPartition& P, StringRef ref)
+{
+  unsigned int n;
+  if (ref.size() < 2 || ref.substr(1).getAsInteger(10, n))
+    return nullptr;
+  if (ref[0] == 'a' && n < P.owner->arg_size())
+    return P.owner->arg_begin() + n;
+  if (ref[0] == 'i' && n < P.instructions.size())
+    return P.instructions[n];
+  return nullptr;
+}
+
+
+/* Index of the operand of user which is v, or -1 */
+int getOperandIndex(const Value *user, const Value *v)
+{
+  const User *u = dyn_cast<User>(user);
+  if (!u)
+    return -1;
+  for (unsigned int i = 0; i < u->getNumOperands(); i++) {
+    if (u->getOperand(i) == v)
+      return i;
+  }
+  return -1;
+}
+
+
+/* Writes the messages exchanged by the function of P with the globals, as
+ * "<tag> <instruction> <operand index> <info>" lines. Messages not between
+ * an instruction and one of its operands can not be written. */
+bool writeMessages(raw_ostream& os, const PropagationPartition& P,
+                   const std::vector<PropagationMessage>& msgs, bool incoming)
+{
+  for (const PropagationMessage& M: msgs) {
+    /* messages to the function are uses of globals, messages from the
+     * function are backtracked to globals */
+    if (M.backward == incoming)
+      return false;
+    const Value *inst = incoming ? M.to : M.from;
+    const Value *op = incoming ? M.from : M.to;
+    int k = getOperandIndex(inst, op);
+    if (k < 0)
+      return false;
+    os << (incoming ? "m " : "o ");
+    if (!writeValueRef(os, P, inst))
+      return false;
+    os << " " << k << " ";
+    if (!InitializerCache::writeValueInfo(os, M.fromInfo))
+      return false;
+    os << "\n";
+  }
+  return true;
+}
+
+}
+
+
+/* Looks up the next round of the propagation of P in the cache. On a hit, the
+ * state of P after the round is restored and true is returned. */
+bool TaffoInitializer::replayPartition(PropagationPartition& P)
+{
+  if (!cache || !P.owner)
+    return false;
+  if (!P.cacheable) {
+    InitCacheSkipped++;
+    return false;
+  }
+
+  std::string input;
+  raw_string_ostream os(input);
+  if (P.cacheKey.empty()) {
+    /* the name of the function is not part of the key, so that the clones
+     * with the same body and the same roots share the entries */
+    indexPartition(P);
+    os << cacheModuleKey << "\n" << *P.owner->getFunctionType() << "\n";
+    ModuleSlotTracker MST(P.owner->getParent(), false);
+    MST.incorporateFunction(*P.owner);
+    for (Instruction *I: P.instructions) {
+      I->print(os, MST);
+      os << "\n";
+    }
+    for (auto& I: P.queue) {
+      os << "r ";
+      P.cacheable &= writeValueRef(os, P, I.first);
+      os << " ";
+      P.cacheable &= InitializerCache::writeValueInfo(os, I.second);
+      os << "\n";
+    }
+  } else {
+    os << P.cacheKey << "\n";
+  }
+  P.cacheable &= writeMessages(os, P, P.inbox, true);
+  if (!P.cacheable) {
+    InitCacheSkipped++;
+    return false;
+  }
+  os.flush();
+
+  MD5 hash;
+  hash.update(input);
+  MD5::MD5Result res;
+  hash.final(res);
+  P.cacheKey = std::string(res.digest().str());
+
+  std::unique_ptr<MemoryBuffer> entry = cache->lookup(P.cacheKey);
+  if (!entry) {
+    InitCacheMisses++;
+    return false;
+  }
+
+  /* entry lines: "q <value> <info>" for the queue in order, followed by
+   * "x <user> <operand>" for the restarted operands and by
+   * "o <instruction> <operand index> <info>" for the outbox */
+  ConvQueueT queue;
+  DenseSet<std::pair<Value *, Value *>> restarted;
+  std::vector<PropagationMessage> outbox;
+  SmallVector<StringRef, 64> lines;
+  entry->getBuffer().split(lines, '\n', -1, false);
+  for (StringRef line: lines) {
+    StringRef tag, ref, info;
+    std::tie(tag, line) = line.split(' ');
+    std::tie(ref, line) = line.split(' ');
+    Value *v = readValueRef(P, ref);
+    bool ok = v != nullptr;
+    if (ok && tag == "q") {
+      ValueInfo vi;
+      ok = InitializerCache::readValueInfo(line, vi, *mdInfoStore);
+      queue.push_back(v, std::move(vi));
+    } else if (ok && tag == "x") {
+      Value *op = readValueRef(P, line);
+      ok = op != nullptr;
+      restarted.insert({v, op});
+    } else if (ok && tag == "o" && isa<User>(v)) {
+      StringRef opIndex;
+      unsigned int k;
+      std::tie(opIndex, info) = line.split(' ');
+      PropagationMessage M;
+      M.from = v;
+      M.backward = true;
+      ok = !opIndex.getAsInteger(10, k) && k < cast<User>(v)->getNumOperands()
+          && InitializerCache::readValueInfo(info, M.fromInfo, *mdInfoStore);
+      if (ok) {
+        M.to = cast<User>(v)->getOperand(k);
+        outbox.push_back(std::move(M));
       }
-      ++next;
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      LLVM_DEBUG(dbgs() << "malformed initializer cache entry " << P.cacheKey << "\n");
+      InitCacheMisses++;
+      return false;
     }
+  }
 
-    for (next = queue.end(); next != queue.begin();) {
-      Value *v = (--next)->first;
-      unsigned int mydepth = next->second.backtrackingDepthLeft;
-      if (mydepth == 0)
-        continue;
+  InitCacheHits++;
+  P.queue = std::move(queue);
+  P.restartedOperands = std::move(restarted);
+  /* the round drained the worklist: its values must not be propagated
+   * again, which would miss the cache in the next round */
+  P.worklist.clear();
+  /* at the end of a round every value in the queue has been visited */
+  P.visited.clear();
+  for (auto& I: P.queue)
+    P.visited.insert(I.first);
+  P.inbox.clear();
+  for (PropagationMessage& M: outbox)
+    P.outbox.push_back(std::move(M));
+  return true;
+}
 
-      Instruction *inst = dyn_cast<Instruction>(v);
-      if (!inst)
-        continue;
 
-      #ifdef LOG_BACKTRACK
-      dbgs() << "BACKTRACK " << *v << ", depth left = " << mydepth << "\n";
-      #endif
+/* Stores the state of P after the round keyed by P.cacheKey */
+void TaffoInitializer::storePartition(PropagationPartition& P)
+{
+  if (!cache || !P.owner || !P.cacheable)
+    return;
+
+  std::string data;
+  raw_string_ostream os(data);
+  for (auto& I: P.queue) {
+    os << "q ";
+    P.cacheable &= writeValueRef(os, P, I.first);
+    os << " ";
+    P.cacheable &= InitializerCache::writeValueInfo(os, I.second);
+    os << "\n";
+  }
+  for (auto& R: P.restartedOperands) {
+    os << "x ";
+    P.cacheable &= writeValueRef(os, P, R.first);
+    os << " ";
+    P.cacheable &= writeValueRef(os, P, R.second);
+    os << "\n";
+  }
+  P.cacheable &= writeMessages(os, P, P.outbox, false);
+  if (!P.cacheable)
+    return;
+  cache->store(P.cacheKey, os.str());
+}
 
-      for (Value *u: inst->operands()) {
-        if (!isa<User>(u) && !isa<Argument>(u)) {
-          #ifdef LOG_BACKTRACK
-          dbgs() << " - " ;
-          u->printAsOperand(dbgs());
-          dbgs() << " not a User or an Argument\n";
-          #endif
-          continue;
-        }
 
-        if (isa<Function>(u) || isa<BlockAddress>(u)) {
-          #ifdef LOG_BACKTRACK
-          dbgs() << " - " ;
-          u->printAsOperand(dbgs());
-          dbgs() << " is a function/block address\n";
-          #endif
+/* Applies the messages received by the partition, then propagates its values
+ * until its worklist is empty. Only modifies the partition (and the metadata
+ * store, which is thread safe). */
+void TaffoInitializer::propagatePartition(PropagationPartition& P)
+{
+  for (PropagationMessage& M: P.inbox) {
+    P.slicer.import(M.from, M.root, M.pulled);
+    if (M.backward)
+      propagateBackward(P, M.from, M.fromInfo, M.to, P.queue.end());
+    else
+      propagateForward(P, M.from, M.fromInfo, M.to);
+  }
+  P.inbox.clear();
+
+  /* Every value is visited once, and then again only when its ValueInfo
+   * changes (root distance decreases, backtracking depth increases,
+   * conversion gets enabled or metadata gets replaced). */
+  while (!P.worklist.empty()) {
+    Value *v = P.worklist.pop();
+    P.visited.insert(v);
+    P.visitCount++;
+
+    auto next = P.queue.find(v);
+    assert(next != P.queue.end() && "value in worklist but not in queue");
+
+    LLVM_DEBUG(dbgs() << "[V] " << *v);
+    if (Instruction *i = dyn_cast<Instruction>(v))
+      LLVM_DEBUG(dbgs() << "[ " << i->getFunction()->getName() << "]\n");
+    else
+      LLVM_DEBUG(dbgs() << "\n");
+    LLVM_DEBUG(dbgs() << "    distance = " << next->second.fixpTypeRootDistance << "\n");
+
+    for (auto *u: v->users()) {
+      /* ignore u if it is the global annotation array */
+      if (GlobalObject *ugo = dyn_cast<GlobalObject>(u)) {
+        if (ugo->hasSection() && ugo->getSection() == "llvm.metadata")
           continue;
-        }
+      }
+
+      propagateForward(P, v, next->second, u);
+    }
+
+    if (P.memory) {
+      if (StoreInst *store = dyn_cast<StoreInst>(v))
+        propagateThroughMemory(P, store, next);
+    }
 
+    unsigned int mydepth = next->second.backtrackingDepthLeft;
+    if (mydepth == 0)
+      continue;
+
+    Instruction *inst = dyn_cast<Instruction>(v);
+    if (!inst)
+      continue;
+
+    #ifdef LOG_BACKTRACK
+    dbgs() << "BACKTRACK " << *v << ", depth left = " << mydepth << "\n";
+    #endif
+
+    for (Value *u: inst->operands()) {
+      if (!isa<User>(u) && !isa<Argument>(u)) {
         #ifdef LOG_BACKTRACK
-        dbgs() << " - " << *u;
+        dbgs() << " - " ;
+        u->printAsOperand(dbgs());
+        dbgs() << " not a User or an Argument\n";
         #endif
+        continue;
+      }
 
-        if (!isFloatType(u->getType())) {
-          #ifdef LOG_BACKTRACK
-          dbgs() << " not a float\n";
-          #endif
-          continue;
-        }
+      if (isa<Function>(u) || isa<BlockAddress>(u)) {
+        #ifdef LOG_BACKTRACK
+        dbgs() << " - " ;
+        u->printAsOperand(dbgs());
+        dbgs() << " is a function/block address\n";
+        #endif
+        continue;
+      }
 
-        bool alreadyIn = false;
-        ValueInfo VIU;
-        VIU.backtrackingDepthLeft = std::min(mydepth, mydepth - 1);
-        auto UI = queue.find(u);
-        if (UI != queue.end()) {
-          if (UI < next)
-            alreadyIn = true;
-          else
-            UI = queue.erase(UI);
-        }
-        if (!alreadyIn) {
-          #ifdef LOG_BACKTRACK
-          dbgs() << "  enqueued\n";
-          #endif
-          next = UI = queue.insert(next, u, std::move(VIU)).first;
-          ++next;
-        } else {
-          #ifdef LOG_BACKTRACK
-          dbgs() << " already in\n";
-          #endif
-        }
-        
-        createInfoOfUser(v, next->second, u, UI->second);
+      /* a phi node may be one of its own operands */
+      if (u == v)
+        continue;
+
+      #ifdef LOG_BACKTRACK
+      dbgs() << " - " << *u;
+      #endif
+
+      if (!isFloatType(u->getType())) {
+        #ifdef LOG_BACKTRACK
+        dbgs() << " not a float\n";
+        #endif
+        continue;
       }
+
+      propagateBackward(P, v, next->second, u, next);
     }
   }
+}
 
-  LLVM_DEBUG(dbgs() << "***** end " << __PRETTY_FUNCTION__ << "\n");
+
+/* Propagates the info of a store to the loads which read the stored value,
+ * and to the allocation whose pointer is stored, if any. */
+void TaffoInitializer::propagateThroughMemory(PropagationPartition& P,
+    StoreInst *store, ConvQueueT::iterator next)
+{
+  for (LoadInst *load: P.memory->getReachedLoads(store))
+    propagateForward(P, store, next->second, load);
+
+  SmallVector<Instruction *, 4> chain;
+  if (!P.memory->getStoredAllocation(store, chain))
+    return;
+  LLVM_DEBUG(dbgs() << "store of allocation " << *chain.back() << "\n");
+  for (Instruction *I: chain) {
+    propagateBackward(P, next->first, next->second, I, next);
+    next = P.queue.find(I);
+  }
+}
+
+
+/* Propagates the info of v to its user u. */
+void TaffoInitializer::propagateForward(PropagationPartition& P,
+    Value *v, const ValueInfo& vinfo, Value *u)
+{
+  if (getOwnerFunction(u) != P.owner) {
+    P.outbox.push_back({v, vinfo, u, false, P.slicer.getRoot(v), P.slicer.isPulled(v)});
+    return;
+  }
+
+  if (isa<PHINode>(u) && P.visited.count(u)) {
+    return;
+  }
+
+  /* pointers passed to calls (memcpy of a buffer of floats through an i8*,
+   * for example) may address floating point data whatever their type */
+  bool pointerArg = isa<CallBase>(u) && v->getType()->isPointerTy();
+  if (FloatPruning && P.owner && !pointerArg && pruneFloatIrrelevant(P, u)) {
+    LLVM_DEBUG(dbgs() << "[U] " << *u << " pruned, no floating point data\n");
+    return;
+  }
+
+  /* Insert u at the end of the queue.
+   * If u exists already in the queue, *move* it to the end instead. */
+  auto UI = P.queue.find(u);
+  bool isNew = UI == P.queue.end();
+  if (isNew) {
+    UI = P.queue.push_back(u, ValueInfo()).first;
+    P.slicer.enqueued(u, v, false);
+  } else {
+    UI = P.queue.moveToBack(UI);
+    P.moveCount++;
+  }
+  ValueInfoState prevUState(UI->second);
+  LLVM_DEBUG(dbgs() << "[U] " << *u);
+  if (Instruction *i = dyn_cast<Instruction>(u))
+    LLVM_DEBUG(dbgs() << "[ " << i->getFunction()->getName() << "]\n");
+  else
+    LLVM_DEBUG(dbgs() << "\n");
+
+  unsigned int vdepth = BacktrackingSlicer::nextDepth(vinfo.backtrackingDepthLeft);
+  if (!P.memory && vdepth < 2 && isa<StoreInst>(u)) {
+    StoreInst *store = dyn_cast<StoreInst>(u);
+    Value *valOp = store->getValueOperand();
+    Type *valueType = valOp->getType();
+    if (isa<BitCastInst>(valOp)
+        && valueType->isPointerTy()
+        && valueType->getPointerElementType()->isFloatingPointTy()) {
+      LLVM_DEBUG(dbgs() << "MALLOC'D POINTER HACK\n");
+      vdepth = 2;
+    }
+  }
+  if (vdepth > 0) {
+    unsigned int udepth = UI->second.backtrackingDepthLeft;
+    UI->second.backtrackingDepthLeft = std::max(vdepth, udepth);
+  }
+  createInfoOfUser(v, vinfo, u, UI->second);
+
+  if (isNew || prevUState.changedIn(UI->second))
+    P.worklist.push(u);
+}
+
+
+/* Propagates the info of v to its operand u. next is the position of v in
+ * the queue of the partition, or the end of the queue if v belongs to
+ * another partition. */
+void TaffoInitializer::propagateBackward(PropagationPartition& P,
+    Value *v, const ValueInfo& vinfo, Value *u, ConvQueueT::iterator next)
+{
+  if (getOwnerFunction(u) != P.owner) {
+    P.outbox.push_back({v, vinfo, u, true, P.slicer.getRoot(v), P.slicer.isPulled(v)});
+    return;
+  }
+
+  unsigned int mydepth = vinfo.backtrackingDepthLeft;
+
+  /* Insert u right before v.
+   * If u is already in the queue after v, *move* it before v instead.
+   * When v is a phi, u is then a value carried around a loop, and it is
+   * restarted from the info of v, as the propagation did before the
+   * worklist. Any other user follows its operands in the queue once they
+   * are visited. The restart is done once per pair, otherwise the forward
+   * propagation to u and the restart could undo each other forever. */
+  auto UI = P.queue.find(u);
+  bool isNew = UI == P.queue.end();
+  if (isNew) {
+    UI = P.queue.insert(next, u, ValueInfo()).first;
+    P.slicer.enqueued(u, v, true);
+  }
+  ValueInfoState prevUState(UI->second);
+  if (isNew || !(UI < next) || next == P.queue.end()) {
+    #ifdef LOG_BACKTRACK
+    dbgs() << "  enqueued\n";
+    #endif
+    bool restart = !isNew && isa<PHINode>(v) && next != P.queue.end()
+        && P.restartedOperands.insert({v, u}).second;
+    UI = P.queue.move(UI, next);
+    if (!isNew)
+      P.moveCount++;
+    P.backtrackCount++;
+    if (restart)
+      UI->second = ValueInfo();
+    unsigned int udepth = UI->second.backtrackingDepthLeft;
+    UI->second.backtrackingDepthLeft = std::max(udepth, BacktrackingSlicer::nextDepth(mydepth));
+  } else {
+    #ifdef LOG_BACKTRACK
+    dbgs() << " already in\n";
+    #endif
+  }
+
+  createInfoOfUser(v, vinfo, u, UI->second);
+
+  if (isNew || prevUState.changedIn(UI->second))
+    P.worklist.push(u);
 }
 
 
@@ -322,13 +1427,14 @@ void TaffoInitializer::createInfoOfUser(Value *used, const ValueInfo& vinfo, Val
       copyok = false;
     if (copyok) {
       LLVM_DEBUG(dbgs() << "createInfoOfUser copied MD from vinfo (" << *used << ") " << vinfo.metadata->toString() << "\n");
-      uinfo.metadata.reset(vinfo.metadata->clone());
+      uinfo.metadata = vinfo.metadata;
     } else {
       LLVM_DEBUG(dbgs() << "createInfoOfUser created MD from uinfo because usedt != usert\n");
-      uinfo.metadata = mdutils::StructInfo::constructFromLLVMType(usert);
-      if (uinfo.metadata.get() == nullptr) {
-        uinfo.metadata.reset(new mdutils::InputInfo(nullptr, nullptr, nullptr, true));
+      std::shared_ptr<mdutils::MDInfo> newmd = mdutils::StructInfo::constructFromLLVMType(usert);
+      if (newmd.get() == nullptr) {
+        newmd.reset(new mdutils::InputInfo(nullptr, nullptr, nullptr, true));
       }
+      uinfo.metadata = mdInfoStore->intern(newmd);
     }
 
     uinfo.target = vinfo.target;
@@ -340,24 +1446,24 @@ void TaffoInitializer::createInfoOfUser(Value *used, const ValueInfo& vinfo, Val
 
   /* The conversion enabling flag shall be true if at least one of the parents
    * of the children has it enabled */
-  mdutils::InputInfo *iiu = dyn_cast_or_null<mdutils::InputInfo>(uinfo.metadata.get());
-  mdutils::InputInfo *iiv = dyn_cast_or_null<mdutils::InputInfo>(vinfo.metadata.get());
+  mdutils::InputInfo *iiu = dyn_cast_or_null<mdutils::InputInfo>(uinfo.metadata);
+  mdutils::InputInfo *iiv = dyn_cast_or_null<mdutils::InputInfo>(vinfo.metadata);
   if (iiu && iiv && iiv->IEnableConversion) {
-    iiu->IEnableConversion = true;
+    uinfo.metadata = mdInfoStore->withConversionEnabled(uinfo.metadata);
   }
 
   // Fix metadata if this is a GetElementPtrInst
-  if (std::shared_ptr<mdutils::MDInfo> gepi_mdi =
+  if (mdutils::MDInfo *gepi_mdi =
       extractGEPIMetadata(user, used, uinfo.metadata, vinfo.metadata)) {
     uinfo.metadata = gepi_mdi;
   }
 }
 
-std::shared_ptr<mdutils::MDInfo>
+mdutils::MDInfo *
 TaffoInitializer::extractGEPIMetadata(const llvm::Value *user,
 				      const llvm::Value *used,
-				      std::shared_ptr<mdutils::MDInfo> user_mdi,
-				      std::shared_ptr<mdutils::MDInfo> used_mdi)
+				      mdutils::MDInfo *user_mdi,
+				      mdutils::MDInfo *used_mdi)
 {
   using namespace mdutils;
   if (!used_mdi)
@@ -384,7 +1490,7 @@ TaffoInitializer::extractGEPIMetadata(const llvm::Value *user,
 
     if (const llvm::ConstantInt* int_i = dyn_cast<llvm::ConstantInt>(*idx_it)) {
       int n = static_cast<int>(int_i->getSExtValue());
-      used_mdi = cast<StructInfo>(used_mdi.get())->getField(n);
+      used_mdi = cast<StructInfo>(used_mdi)->getField(n).get();
       source_element_type =
       cast<StructType>(source_element_type)->getTypeAtIndex(n);
     } else {
@@ -396,101 +1502,764 @@ TaffoInitializer::extractGEPIMetadata(const llvm::Value *user,
     LLVM_DEBUG(dbgs() << "[extractGEPIMetadata] end, used_mdi=" << used_mdi->toString() << "\n");
   else
     LLVM_DEBUG(dbgs() << "[extractGEPIMetadata] end, used_mdi=NULL\n");
-  return (used_mdi)
-    ? std::shared_ptr<mdutils::MDInfo>(used_mdi.get()->clone())
-    : nullptr;
+  /* the fields of an interned struct are interned as well */
+  return used_mdi;
 }
 
 
-void TaffoInitializer::generateFunctionSpace(ConvQueueT& vals,
-    ConvQueueT& global, SmallPtrSet<Function *, 10> &callTrace)
+/* Specializes the functions called by the values in the queue.
+ * The call sites are processed top-down on the strongly connected components
+ * of the call graph, and the calls in each new clone are specialized right
+ * after the clone is created. Therefore each clone is built from a single
+ * propagation, and a function is never specialized twice for the same
+ * arguments. */
+void TaffoInitializer::generateFunctionSpace(Module &m, CallGraph &cg, ConvQueueT& vals)
 {
   LLVM_DEBUG(dbgs() << "***** begin " << __PRETTY_FUNCTION__ << "\n");
-  
-  for (auto VVI: vals) {
-    Value *v = VVI->first;
-    if (!(isa<CallInst>(v) || isa<InvokeInst>(v)))
+
+  /* scc_iterator visits the SCCs bottom-up, callers come first when the
+   * order is reversed */
+  unsigned int sccIndex = 0;
+  for (auto sccIt = scc_begin(&cg); !sccIt.isAtEnd(); ++sccIt, sccIndex++) {
+    for (CallGraphNode *node: *sccIt) {
+      if (Function *f = node->getFunction())
+        sccOrder[f] = UINT_MAX - sccIndex;
+    }
+  }
+
+  std::vector<Instruction *> calls;
+  for (auto& VVI: vals) {
+    Value *v = VVI.first;
+    if (isa<CallInst>(v) || isa<InvokeInst>(v))
+      calls.push_back(cast<Instruction>(v));
+  }
+  std::stable_sort(calls.begin(), calls.end(), [&](Instruction *a, Instruction *b) {
+    return sccOrder.lookup(a->getFunction()) < sccOrder.lookup(b->getFunction());
+  });
+
+  ActiveClonesT activeClones;
+  for (Instruction *call: calls)
+    specializeCall(call, vals, activeClones);
+
+  LLVM_DEBUG(dbgs() << "***** end " << __PRETTY_FUNCTION__ << "\n");
+}
+
+
+/* Redirects a call to the clone of the called function specialized for the
+ * info of its arguments, creating the clone if it does not exist yet.
+ * activeClones maps the functions whose clones are being specialized along
+ * the current chain of calls to those clones. */
+void TaffoInitializer::specializeCall(Instruction *callInst, ConvQueueT& vals, ActiveClonesT &activeClones)
+{
+  CallSite call(callInst);
+
+  Function *oldF = call.getCalledFunction();
+  if (!oldF) {
+    LLVM_DEBUG(dbgs() << "found bitcasted funcptr in " << *callInst << ", skipping\n");
+    return;
+  }
+  /* functions defined in other modules are specialized through the summaries,
+   * except for the library functions, which no module defines */
+  LibFunc libFunc;
+  bool external = (summary || importedSummary) && oldF->isDeclaration() && !oldF->isIntrinsic() &&
+                  !targetLibraryInfo->getLibFunc(oldF->getName(), libFunc);
+  if(isSpecialFunction(oldF) && !external)
+    return;
+  if (ManualFunctionCloning) {
+    if (enabledFunctions.count(oldF) == 0) {
+      LLVM_DEBUG(dbgs() << "skipped cloning of function from call " << *callInst << ": function disabled\n");
+      return;
+    }
+  }
+
+  std::string signature;
+  if (!getCallSignature(call, vals, signature)) {
+    LLVM_DEBUG(dbgs() << "skipped cloning of function from call " << *callInst << ": no argument info\n");
+    return;
+  }
+
+  if (external) {
+    specializeExternalCall(call, vals, signature);
+    return;
+  }
+
+  auto active = activeClones.find(oldF);
+  if (active != activeClones.end()) {
+    /* Recursive call inside the SCC being specialized: it is bound to the
+     * clone of the current round, and the info of its arguments is joined to
+     * the one the next round is built from, if any */
+    std::vector<Optional<ValueInfo>>& joined = active->second.joined;
+    for (unsigned i = 0; i < oldF->arg_size(); i++) {
+      auto argI = vals.find(call.getArgOperand(i));
+      if (argI == vals.end() || !argI->second.metadata)
+        continue;
+      if (!joined[i])
+        joined[i] = argI->second;
+      else
+        joinValueInfo(*joined[i], argI->second);
+    }
+    LLVM_DEBUG(dbgs() << "recursive call " << *callInst << " bound to " << active->second.clone->getName() << "\n");
+    ValueInfo ret;
+    getReturnInfo(active->second.clone, vals, ret);
+    bindCall(call, oldF, active->second.clone, ret, vals);
+    RecursiveCallsBound++;
+    return;
+  }
+
+  if (const FunctionSpecialization *spec = findSpecialization(oldF, signature)) {
+    LLVM_DEBUG(dbgs() << "reusing clone " << spec->clone->getName() << " for call " << *callInst << "\n");
+    bindCall(call, oldF, spec->clone, spec->ret, vals);
+    FunctionCloneReused++;
+    return;
+  }
+
+  LLVM_DEBUG(dbgs() << "  callsite instr " << *callInst << " [" << callInst->getFunction()->getName() << "]\n");
+  SmallVector<const ValueInfo *, 8> argInfo;
+  for (unsigned i = 0; i < oldF->arg_size(); i++) {
+    auto argI = vals.find(call.getArgOperand(i));
+    argInfo.push_back(argI == vals.end() ? nullptr : &argI->second);
+  }
+  const FunctionSpecialization *spec = specializeFunction(oldF, signature, argInfo, vals, activeClones);
+  bindCall(call, oldF, spec->clone, spec->ret, vals);
+}
+
+
+/* Redirects a call to a clone of oldF. The call gets the info returned by
+ * the clone when it comes from a closer root, and the info of the call is
+ * then propagated again to the values of the caller. */
+void TaffoInitializer::bindCall(CallSite& call, Function *oldF, Function *clone, const ValueInfo& ret, ConvQueueT& vals)
+{
+  Instruction *callInst = call.getInstruction();
+  call.setCalledFunction(clone);
+  callInst->setMetadata(ORIGINAL_FUN_METADATA,
+      MDNode::get(callInst->getContext(), ValueAsMetadata::get(oldF)));
+  changes.callGraph = true;
+
+  /* The call is one step further than the returned values from their root,
+   * as any other user: the info is only replaced when it is strictly closer
+   * than the one the call has, which is the rule of createInfoOfUser. */
+  auto CI = vals.find(callInst);
+  if (!ret.metadata || CI == vals.end() ||
+      std::max(ret.fixpTypeRootDistance, ret.fixpTypeRootDistance + 1) >= CI->second.fixpTypeRootDistance)
+    return;
+  CI->second.metadata = ret.metadata;
+  CI->second.fixpTypeRootDistance = ret.fixpTypeRootDistance + 1;
+  LLVM_DEBUG(dbgs() << "  return info of " << clone->getName() << " given to " << *callInst << "\n");
+  propagateCallInfo(callInst, vals);
+}
+
+
+/* Propagates the info of call, which has changed after the propagation, to
+ * the values of its function. The values of the function in vals keep their
+ * info unless the call is closer to their root. The values which are updated
+ * or added are moved to the end of vals, in the order of the propagation; as
+ * in buildConversionQueueForClone, nothing is propagated to the globals. */
+void TaffoInitializer::propagateCallInfo(Instruction *call, ConvQueueT& vals)
+{
+  Function *f = call->getFunction();
+  PropagationPartition P(f);
+  for (auto& V: vals) {
+    if (getOwnerFunction(V.first) != f)
       continue;
-    CallSite *call = new CallSite(v);
-    
-    Function *oldF = call->getCalledFunction();
-    if (!oldF) {
-      LLVM_DEBUG(dbgs() << "found bitcasted funcptr in " << *v << ", skipping\n");
+    P.queue.push_back(V.first, V.second);
+    P.visited.insert(V.first);
+  }
+  P.worklist.push(call);
+  P.slicer.import(call, backtrackingSlicer.getRoot(call), backtrackingSlicer.isPulled(call));
+
+  prepareFunctionPartition(P);
+  propagatePartition(P);
+  P.outbox.clear();
+
+  /* the queue of the partition keeps the operands before their users from
+   * the first value which changed onwards */
+  bool changed = false;
+  for (auto& V: P.queue) {
+    auto VI = vals.find(V.first);
+    if (!changed) {
+      changed = VI == vals.end() || ValueInfoState(VI->second).changedIn(V.second);
+      if (!changed)
+        continue;
+    }
+    if (VI != vals.end())
+      vals.erase(VI);
+    vals.push_back(V.first, V.second);
+  }
+  finishPartition(P);
+  LLVM_DEBUG(dbgs() << "  propagated the info of " << *call << " again in " << f->getName() << "\n");
+}
+
+
+/* Creates the clone of oldF specialized for the info of its arguments (argInfo
+ * has an entry for each formal argument, nullptr if the argument has no info),
+ * and specializes the calls in the clone.
+ *
+ * When oldF is in a recursive SCC, the recursive calls reached from the clone
+ * are bound to it, and the info of their arguments is joined to the one of
+ * argInfo. If the joined info is wider, the clones of the SCC built in the
+ * round are discarded, and they are built again from it. The info of the
+ * arguments of a recursive call comes from the info of the clone or from a
+ * root of the SCC, and the join only widens it, therefore the rounds end.
+ * The specialization returned may then be the one of the joined info, whose
+ * signature differs from the one given. */
+const FunctionSpecialization *TaffoInitializer::specializeFunction(Function *oldF, const std::string& signature,
+    ArrayRef<const ValueInfo *> argInfo, ConvQueueT& vals, ActiveClonesT &activeClones)
+{
+  TimeTraceScope trace("Specialize function", oldF->getName());
+  std::vector<Optional<ValueInfo>> args;
+  for (const ValueInfo *info: argInfo)
+    args.push_back(info ? Optional<ValueInfo>(*info) : None);
+  std::string roundSignature = signature;
+  size_t firstClone = createdClones.size();
+  /* the joined info of the enclosing clones of the SCC, restored when a round
+   * which contributed to it is discarded */
+  std::vector<std::pair<Function *, std::vector<Optional<ValueInfo>>>> outer;
+  for (auto& A: activeClones)
+    outer.push_back(std::make_pair(A.first, A.second.joined));
+
+  while (true) {
+    SmallVector<const ValueInfo *, 8> roundInfo;
+    for (Optional<ValueInfo>& info: args)
+      roundInfo.push_back(info.hasValue() ? info.getPointer() : nullptr);
+    Function *newF = cloneForSpecialization(oldF, roundInfo, vals);
+    createdClones.push_back(std::make_pair(oldF, newF));
+
+    std::vector<Instruction *> innerCalls;
+    for (BasicBlock& bb: *newF) {
+      for (Instruction& i: bb) {
+        if ((isa<CallInst>(i) || isa<InvokeInst>(i)) && vals.count(&i))
+          innerCalls.push_back(&i);
+      }
+    }
+
+    /* The callees of the clone are in the same SCC as oldF or below it */
+    activeClones[oldF] = ActiveSpecialization{newF, args};
+    for (Instruction *innerCall: innerCalls)
+      specializeCall(innerCall, vals, activeClones);
+    /* the map may have grown while specializing the inner calls */
+    auto active = activeClones.find(oldF);
+    std::vector<Optional<ValueInfo>> joined = std::move(active->second.joined);
+    activeClones.erase(active);
+
+    bool stable = true;
+    for (unsigned i = 0; i < args.size() && stable; i++)
+      stable = args[i].hasValue() == joined[i].hasValue() && (!args[i] || args[i]->metadata == joined[i]->metadata);
+    if (stable) {
+      MDNode *newFRef = MDNode::get(oldF->getContext(), ValueAsMetadata::get(newF));
+      if (MDNode *cloned = oldF->getMetadata(CLONED_FUN_METADATA))
+        oldF->setMetadata(CLONED_FUN_METADATA, MDNode::concatenate(cloned, newFRef));
+      else
+        oldF->setMetadata(CLONED_FUN_METADATA, newFRef);
+
+      std::vector<FunctionSpecialization>& specs = specializations[oldF];
+      specs.push_back({hash_value(roundSignature), roundSignature, newF, ValueInfo()});
+      getReturnInfo(newF, vals, specs.back().ret);
+      return &specs.back();
+    }
+
+    RecursiveSpecializationRounds++;
+    discardClones(firstClone, oldF, vals);
+    for (auto& O: outer)
+      activeClones.find(O.first)->second.joined = O.second;
+    args = std::move(joined);
+    roundInfo.clear();
+    for (Optional<ValueInfo>& info: args)
+      roundInfo.push_back(info.hasValue() ? info.getPointer() : nullptr);
+    roundSignature.clear();
+    getArgsSignature(roundInfo, roundSignature);
+    LLVM_DEBUG(dbgs() << "specializing " << oldF->getName() << " again for the joined info " << roundSignature << "\n");
+    if (const FunctionSpecialization *spec = findSpecialization(oldF, roundSignature))
+      return spec;
+  }
+}
+
+
+/* Creates the clone of oldF for the given info of its arguments, and builds
+ * the conversion queue of the clone. */
+Function *TaffoInitializer::cloneForSpecialization(Function *oldF, ArrayRef<const ValueInfo *> argInfo, ConvQueueT& vals)
+{
+  ValueToValueMapTy vmap;
+  Function *newF = createFunctionAndQueue(oldF, argInfo, vals, vmap);
+  changes.callGraph = true;
+  enabledFunctions.insert(newF);
+
+  //Attach metadata
+  MDNode *oldFRef = MDNode::get(oldF->getContext(),ValueAsMetadata::get(oldF));
+  newF->setMetadata(CLONED_FUN_METADATA, NULL);
+  newF->setMetadata(SOURCE_FUN_METADATA, oldFRef);
+
+  /* Reconstruct the value info for the values which are in the top-level
+   * conversion queue and in the oldF, unless the propagation in the clone
+   * reached them from a closer root. This keeps the info of the values
+   * annotated in oldF (their annotation calls are gone by now), and allows us
+   * to properly process call functions */
+  for (BasicBlock& bb: *oldF) {
+    for (Instruction& oldI: bb) {
+      auto OI = vals.find(&oldI);
+      if (OI == vals.end())
+        continue;
+      Value *newV = vmap.lookup(&oldI);
+      if (!newV)
+        continue;
+      auto NI = vals.insert(vals.end(), newV, OI->second);
+      if (!NI.second && OI->second.fixpTypeRootDistance < NI.first->second.fixpTypeRootDistance)
+        NI.first->second = OI->second;
+      LLVM_DEBUG(dbgs() << "  enqueued & rebuilt valueInfo of " << *newV << " in " << newF->getName() << "\n");
+    }
+  }
+  return newF;
+}
+
+
+/* Removes the given clones from the list of clones of oldF */
+static void removeClonedFunctions(Function *oldF, const SmallPtrSetImpl<Function *>& dead)
+{
+  MDNode *cloned = oldF->getMetadata(CLONED_FUN_METADATA);
+  if (!cloned)
+    return;
+  SmallVector<Metadata *, 4> alive;
+  for (const MDOperand& op: cloned->operands()) {
+    auto *VAM = dyn_cast_or_null<ValueAsMetadata>(op.get());
+    if (!VAM || !dead.count(dyn_cast<Function>(VAM->getValue())))
+      alive.push_back(op.get());
+  }
+  if (alive.empty())
+    oldF->setMetadata(CLONED_FUN_METADATA, nullptr);
+  else if (alive.size() != cloned->getNumOperands())
+    oldF->setMetadata(CLONED_FUN_METADATA, MDNode::get(oldF->getContext(), alive));
+}
+
+
+/* Removes the clones of the functions in the SCC of oldF created since the
+ * clone number first, together with their values. The clones of the callees
+ * below the SCC are complete specializations, and they are kept. */
+void TaffoInitializer::discardClones(size_t first, Function *oldF, ConvQueueT& vals)
+{
+  unsigned int scc = sccOrder.lookup(oldF);
+  SmallPtrSet<Function *, 8> discarded;
+  SmallPtrSet<Function *, 8> sources;
+  std::vector<std::pair<Function *, Function *>> kept;
+  for (size_t i = first; i < createdClones.size(); i++) {
+    auto& C = createdClones[i];
+    if (sccOrder.lookup(C.first) != scc) {
+      kept.push_back(C);
       continue;
     }
-    if(isSpecialFunction(oldF))
+    discarded.insert(C.second);
+    sources.insert(C.first);
+  }
+  createdClones.resize(first);
+  createdClones.insert(createdClones.end(), kept.begin(), kept.end());
+
+  for (Function *source: sources) {
+    removeClonedFunctions(source, discarded);
+    auto S = specializations.find(source);
+    if (S == specializations.end())
       continue;
-    if (ManualFunctionCloning) {
-      if (enabledFunctions.count(oldF) == 0) {
-        LLVM_DEBUG(dbgs() << "skipped cloning of function from call " << *v << ": function disabled\n");
-        continue;
+    S->second.erase(std::remove_if(S->second.begin(), S->second.end(),
+        [&](const FunctionSpecialization& spec) { return discarded.count(spec.clone) != 0; }),
+        S->second.end());
+  }
+
+  DenseSet<Value *> deleted;
+  for (Function *f: discarded) {
+    if (memoryAccounting)
+      memoryAccounting->add(MemoryAccounting::CloneIR, -static_cast<int64_t>(f->getInstructionCount()),
+                            -static_cast<int64_t>(MemoryAccounting::estimateIRSize(*f)));
+    for (Argument& a: f->args()) {
+      vals.erase(&a);
+      deleted.insert(&a);
+    }
+    for (Instruction& I: instructions(f)) {
+      vals.erase(&I);
+      deleted.insert(&I);
+    }
+    enabledFunctions.erase(f);
+    f->dropAllReferences();
+  }
+  backtrackingSlicer.forget(deleted);
+  for (Function *f: discarded) {
+    invalidateFunctionAnalyses(f, true);
+    f->eraseFromParent();
+  }
+}
+
+
+/* Joins the info of the values returned by f into res */
+void TaffoInitializer::getReturnInfo(Function *f, ConvQueueT& vals, ValueInfo& res)
+{
+  for (BasicBlock& bb: *f) {
+    ReturnInst *ret = dyn_cast_or_null<ReturnInst>(bb.getTerminator());
+    if (!ret || !ret->getReturnValue())
+      continue;
+    auto RI = vals.find(ret->getReturnValue());
+    if (RI != vals.end() && RI->second.metadata)
+      joinValueInfo(res, RI->second);
+  }
+}
+
+
+/* Widens info to contain other as well */
+void TaffoInitializer::joinValueInfo(ValueInfo& info, const ValueInfo& other)
+{
+  info.metadata = mdInfoStore->join(info.metadata, other.metadata);
+  info.fixpTypeRootDistance = std::min(info.fixpTypeRootDistance, other.fixpTypeRootDistance);
+  info.backtrackingDepthLeft = std::max(info.backtrackingDepthLeft, other.backtrackingDepthLeft);
+  if (!info.target)
+    info.target = other.target;
+}
+
+
+/* Records the call to a function defined in another module in the summary,
+ * and redirects it to the clone which the defining module creates for it,
+ * if the imported summary requests that clone. */
+void TaffoInitializer::specializeExternalCall(CallSite& call, ConvQueueT& vals, const std::string& signature)
+{
+  Function *oldF = call.getCalledFunction();
+  std::string callee = oldF->getName().str();
+  auto key = std::make_pair(callee, signature);
+
+  if (summary) {
+    auto req = summary->clones.insert(std::make_pair(key, AnnotationSummary::CloneRequest()));
+    if (req.second) {
+      for (unsigned i = 0; i < oldF->arg_size(); i++) {
+        std::string info;
+        auto argI = vals.find(call.getArgOperand(i));
+        if (argI != vals.end()) {
+          raw_string_ostream os(info);
+          if (!InitializerCache::writeValueInfo(os, argI->second)) {
+            os.flush();
+            info.clear();
+          }
+        }
+        req.first->second.args.push_back(info);
       }
+      SummaryClonesRequested++;
     }
+  }
 
-    std::vector<llvm::Value*> newVals;
-    
-    Function *newF = createFunctionAndQueue(call, vals, global, newVals);
-    call->setCalledFunction(newF);
-    enabledFunctions.insert(newF);
-
-    //Attach metadata
-    MDNode *newFRef = MDNode::get(call->getInstruction()->getContext(),ValueAsMetadata::get(newF));
-    MDNode *oldFRef = MDNode::get(call->getInstruction()->getContext(),ValueAsMetadata::get(oldF));
-
-    call->getInstruction()->setMetadata(ORIGINAL_FUN_METADATA, oldFRef);
-    if (MDNode *cloned = oldF->getMetadata(CLONED_FUN_METADATA)) {
-      cloned = cloned->concatenate(cloned, newFRef);
-      oldF->setMetadata(CLONED_FUN_METADATA, cloned);
-    } else {
-      oldF->setMetadata(CLONED_FUN_METADATA, newFRef);
+  if (!importedSummary || !importedSummary->functions.count(callee) || !importedSummary->clones.count(key))
+    return;
+  std::string name = AnnotationSummary::getCloneName(callee, signature);
+  Function *clone = oldF->getParent()->getFunction(name);
+  if (!clone) {
+    /* a weak reference to oldF stays weak, oldF may not be defined anywhere */
+    GlobalValue::LinkageTypes linkage = oldF->hasExternalWeakLinkage() ?
+        GlobalValue::ExternalWeakLinkage : GlobalValue::ExternalLinkage;
+    clone = Function::Create(oldF->getFunctionType(), linkage, name, oldF->getParent());
+  }
+  LLVM_DEBUG(dbgs() << "call " << *call.getInstruction() << " bound to " << name << " of another module\n");
+  call.setCalledFunction(clone);
+  call.getInstruction()->setMetadata(ORIGINAL_FUN_METADATA,
+      MDNode::get(oldF->getContext(), ValueAsMetadata::get(oldF)));
+  changes.callGraph = true;
+  SummaryCallsRedirected++;
+}
+
+
+/* Makes roots of the declarations of the globals and of the calls to the
+ * functions which are annotated in the modules that define them */
+void TaffoInitializer::importSummaryRoots(Module &m, ConvQueueT& roots)
+{
+  for (GlobalVariable& gv: m.globals()) {
+    if (!gv.isDeclaration() || roots.count(&gv))
+      continue;
+    auto G = importedSummary->globals.find(gv.getName().str());
+    if (G == importedSummary->globals.end())
+      continue;
+    ValueInfo vi;
+    if (!InitializerCache::readValueInfo(G->second, vi, *mdInfoStore))
+      continue;
+    vi.fixpTypeRootDistance = 0;
+    roots.push_back(&gv, vi);
+    SummaryRootsImported++;
+  }
+
+  ConvQueueT calls;
+  for (Function& f: m.functions()) {
+    if (!f.isDeclaration() || f.isIntrinsic())
+      continue;
+    auto F = importedSummary->functions.find(f.getName().str());
+    if (F == importedSummary->functions.end() || F->second.ret.empty())
+      continue;
+    ValueInfo vi;
+    if (!InitializerCache::readValueInfo(F->second.ret, vi, *mdInfoStore))
+      continue;
+    vi.fixpTypeRootDistance = 0;
+    enabledFunctions.insert(&f);
+    /* the calls which only pass f as an argument (callbacks) do not
+     * return its value */
+    for (User *user: f.users()) {
+      if ((isa<CallInst>(user) || isa<InvokeInst>(user)) && CallSite(user).getCalledFunction() == &f)
+        calls.push_back(user, vi);
+    }
+  }
+  removeNoFloatTy(calls);
+  SummaryRootsImported += calls.size();
+  roots.insert(roots.end(), calls.begin(), calls.end());
+}
+
+
+/* Creates the clones requested by the other modules for the functions defined
+ * in this one. They are externally visible, and named after the signature of
+ * the calls which requested them. A clone is always created for a request,
+ * even when the info of its arguments can not be read, because the calls of
+ * the other modules have already been bound to it. */
+void TaffoInitializer::importClones(Module &m, ConvQueueT& vals)
+{
+  for (auto& C: importedSummary->clones) {
+    Function *oldF = m.getFunction(C.first.first);
+    if (!oldF || oldF->isDeclaration() || oldF->hasLocalLinkage() || isSpecialFunction(oldF))
+      continue;
+    const std::string& signature = C.first.second;
+    std::string name = AnnotationSummary::getCloneName(oldF->getName(), signature);
+    Function *existing = m.getFunction(name);
+    if (existing && !existing->isDeclaration())
+      continue;
+
+    /* a local clone for the same signature is exported instead of duplicated */
+    const FunctionSpecialization *spec = findSpecialization(oldF, signature);
+    if (!spec) {
+      std::vector<ValueInfo> infos(oldF->arg_size());
+      SmallVector<const ValueInfo *, 8> argInfo(oldF->arg_size(), nullptr);
+      for (unsigned i = 0; i < oldF->arg_size() && i < C.second.args.size(); i++) {
+        const std::string& info = C.second.args[i];
+        if (!info.empty() && InitializerCache::readValueInfo(info, infos[i], *mdInfoStore))
+          argInfo[i] = &infos[i];
+      }
+      ActiveClonesT activeClones;
+      spec = specializeFunction(oldF, signature, argInfo, vals, activeClones);
+    }
+    Function *newF = spec->clone;
+
+    /* An inline or weak oldF may be defined by other modules too, and each of
+     * them exports the same clone: the linker must keep only one of them. The
+     * clones of an ODR function are equivalent, those of a weak function may
+     * differ as its definitions do, and stay interposable. */
+    if (!oldF->isWeakForLinker())
+      newF->setLinkage(GlobalValue::ExternalLinkage);
+    else if (oldF->hasLinkOnceODRLinkage() || oldF->hasWeakODRLinkage())
+      newF->setLinkage(GlobalValue::WeakODRLinkage);
+    else
+      newF->setLinkage(GlobalValue::WeakAnyLinkage);
+    if (existing) {
+      existing->replaceAllUsesWith(newF);
+      enabledFunctions.erase(existing);
+      invalidateFunctionAnalyses(existing, true);
+      existing->eraseFromParent();
     }
-    newF->setMetadata(CLONED_FUN_METADATA, NULL);
-    newF->setMetadata(SOURCE_FUN_METADATA, oldFRef);
+    newF->setName(name);
+    LLVM_DEBUG(dbgs() << "exported clone " << name << " of " << oldF->getName() << "\n");
+    SummaryClonesExported++;
+  }
+}
+
+
+/* Writes the summary of the module: the info of the externally visible
+ * globals, the externally visible functions with the info of their return
+ * value, and the clones requested to the other modules (which have been
+ * recorded by specializeExternalCall). */
+void TaffoInitializer::writeSummary(Module &m, ConvQueueT& vals)
+{
+  for (GlobalVariable& gv: m.globals()) {
+    if (gv.isDeclaration() || gv.hasLocalLinkage())
+      continue;
+    auto G = vals.find(&gv);
+    if (G == vals.end())
+      continue;
+    std::string info;
+    raw_string_ostream os(info);
+    if (InitializerCache::writeValueInfo(os, G->second))
+      summary->globals[gv.getName().str()] = os.str();
+  }
 
-    mdutils::MetadataManager& mm = mdutils::MetadataManager::getMetadataManager();
-    for (auto v: newVals) {
-      Instruction *i = dyn_cast<Instruction>(v);
-      if (!i || !mm.retrieveInputInfo(*i))
-        setMetadataOfValue(v, vals[v]);
+  for (Function& f: m.functions()) {
+    if (f.isDeclaration() || f.hasLocalLinkage() || isSpecialFunction(&f))
+      continue;
+    AnnotationSummary::FunctionSummary& fs = summary->functions[f.getName().str()];
+    auto F = functionAnnotations.find(&f);
+    if (F == functionAnnotations.end())
+      continue;
+    raw_string_ostream os(fs.ret);
+    if (!InitializerCache::writeValueInfo(os, F->second)) {
+      os.flush();
+      fs.ret.clear();
     }
+  }
 
-    /* Reconstruct the value info for the values which are in the top-level
-     * conversion queue and in the oldF
-     * Allows us to properly process call functions */
-    // TODO: REWRITE USING THE VALUE MAP RETURNED BY CloneFunctionInto
-    for (BasicBlock& bb: *newF) {
-      for (Instruction& i: bb) {
-        if (mdutils::MDInfo *mdi = mm.retrieveMDInfo(&i)) {
-          ValueInfo& vi = vals.insert(vals.end(), &i, ValueInfo()).first->second;
-          vi.metadata.reset(mdi->clone());
-          int weight = mm.retrieveInputInfoInitWeightMetadata(&i);
-          if (weight >= 0)
-            vi.fixpTypeRootDistance = weight;
-          vals.push_back(&i, vi);
-          LLVM_DEBUG(dbgs() << "  enqueued & rebuilt valueInfo of " << i << " in " << newF->getName() << "\n");
+  std::error_code EC;
+  raw_fd_ostream os(summaryOutPath, EC, sys::fs::OF_Text);
+  if (EC) {
+    errs() << "TAFFO initializer: can not write the summary to " << summaryOutPath
+           << ": " << EC.message() << "\n";
+    return;
+  }
+  summary->write(os);
+}
+
+
+/* Removes the originals and the clones which are not referenced anymore
+ * after the specialization. Only functions with local linkage are removed,
+ * the others may be called from other modules. The metadata which links the
+ * clones to their originals is updated to refer only to the functions left. */
+void TaffoInitializer::removeDeadFunctions(Module &m, ConvQueueT& vals)
+{
+  SmallPtrSet<Function *, 16> candidates;
+  SmallPtrSet<Function *, 16> clones;
+  for (auto& S: specializations) {
+    candidates.insert(S.first);
+    for (const FunctionSpecialization& spec: S.second) {
+      candidates.insert(spec.clone);
+      clones.insert(spec.clone);
+    }
+  }
+
+  /* removing a function may leave its callees unreferenced */
+  SmallPtrSet<Function *, 16> dead;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (Function *f: candidates) {
+      if (dead.count(f) || !f->hasLocalLinkage())
+        continue;
+      f->removeDeadConstantUsers();
+      bool referenced = false;
+      for (User *U: f->users()) {
+        Instruction *I = dyn_cast<Instruction>(U);
+        if (!I || !dead.count(I->getFunction())) {
+          referenced = true;
+          break;
         }
       }
+      if (referenced)
+        continue;
+      LLVM_DEBUG(dbgs() << "removing unreferenced function " << f->getName() << "\n");
+      dead.insert(f);
+      changed = true;
     }
   }
-  
-  LLVM_DEBUG(dbgs() << "***** end " << __PRETTY_FUNCTION__ << "\n");
+  if (dead.empty())
+    return;
+
+  MDNode *none = nullptr;
+  auto refersToDead = [&](const MDNode *ref) -> bool {
+    if (!ref || ref->getNumOperands() == 0)
+      return false;
+    auto *VAM = dyn_cast_or_null<ValueAsMetadata>(ref->getOperand(0).get());
+    return VAM && dead.count(dyn_cast<Function>(VAM->getValue()));
+  };
+
+  for (auto& S: specializations) {
+    Function *oldF = S.first;
+    if (dead.count(oldF)) {
+      /* the clones left have no source anymore */
+      for (const FunctionSpecialization& spec: S.second) {
+        if (dead.count(spec.clone))
+          continue;
+        spec.clone->setMetadata(SOURCE_FUN_METADATA, none);
+        for (User *U: spec.clone->users()) {
+          if (Instruction *call = dyn_cast<Instruction>(U)) {
+            if (refersToDead(call->getMetadata(ORIGINAL_FUN_METADATA)))
+              call->setMetadata(ORIGINAL_FUN_METADATA, none);
+          }
+        }
+      }
+      continue;
+    }
+
+    removeClonedFunctions(oldF, dead);
+    S.second.erase(std::remove_if(S.second.begin(), S.second.end(),
+        [&](const FunctionSpecialization& spec) { return dead.count(spec.clone) != 0; }),
+        S.second.end());
+  }
+
+  DenseSet<Value *> deleted;
+  for (Function *f: dead) {
+    if (memoryAccounting && clones.count(f))
+      memoryAccounting->add(MemoryAccounting::CloneIR, -static_cast<int64_t>(f->getInstructionCount()),
+                            -static_cast<int64_t>(MemoryAccounting::estimateIRSize(*f)));
+    for (Argument& a: f->args()) {
+      vals.erase(&a);
+      deleted.insert(&a);
+    }
+    for (Instruction& I: instructions(f)) {
+      vals.erase(&I);
+      deleted.insert(&I);
+      DeadInstructionsRemoved++;
+    }
+    specializations.erase(f);
+    localAnnotationCalls.erase(f);
+    enabledFunctions.erase(f);
+    f->dropAllReferences();
+  }
+  backtrackingSlicer.forget(deleted);
+  for (Function *f: dead) {
+    invalidateFunctionAnalyses(f, true);
+    f->eraseFromParent();
+    DeadFunctionsRemoved++;
+  }
+  changes.callGraph = true;
 }
 
 
-Function* TaffoInitializer::createFunctionAndQueue(llvm::CallSite *call, ConvQueueT& vals, ConvQueueT& global, std::vector<llvm::Value*> &convQueue)
+/* Computes the signature identifying which specialization of the called
+ * function is required by the call. Returns false if no argument carries
+ * any info, in which case the original function is good enough. */
+bool TaffoInitializer::getCallSignature(CallSite& call, ConvQueueT& vals, std::string& signature)
+{
+  bool hasInfo = false;
+  SmallVector<const ValueInfo *, 8> argInfo;
+  for (unsigned i = 0; i < call.arg_size(); i++) {
+    auto argI = vals.find(call.getArgOperand(i));
+    argInfo.push_back(argI == vals.end() ? nullptr : &argI->second);
+    hasInfo |= argI != vals.end() && argI->second.metadata;
+  }
+  getArgsSignature(argInfo, signature);
+  return hasInfo;
+}
+
+
+void TaffoInitializer::getArgsSignature(ArrayRef<const ValueInfo *> argInfo, std::string& signature)
+{
+  raw_string_ostream os(signature);
+  for (const ValueInfo *info: argInfo) {
+    if (info && info->metadata)
+      MDInfoStore::encode(os, info->metadata);
+    os << ";";
+  }
+  os.flush();
+}
+
+
+const FunctionSpecialization *TaffoInitializer::findSpecialization(Function *oldF, const std::string& signature)
+{
+  auto clones = specializations.find(oldF);
+  if (clones == specializations.end())
+    return nullptr;
+  hash_code hash = hash_value(signature);
+  for (const FunctionSpecialization& spec: clones->second) {
+    if (spec.hash == hash && spec.signature == signature)
+      return &spec;
+  }
+  return nullptr;
+}
+
+
+Function* TaffoInitializer::createFunctionAndQueue(Function *oldF, ArrayRef<const ValueInfo *> argInfo,
+    ConvQueueT& vals, ValueToValueMapTy &mapArgs)
 {
   LLVM_DEBUG(dbgs() << "***** begin " << __PRETTY_FUNCTION__ << "\n");
   
-  /* vals: conversion queue of caller
-   * global: global values to copy in all converison queues
-   * convQueue: output conversion queue of this function */
+  /* argInfo: info of each argument of the call, nullptr if it has none
+   * vals: conversion queue of caller
+   * mapArgs: output mapping from the values of the original function to the
+   *   ones of the clone */
   
-  Function *oldF = call->getCalledFunction();
   Function *newF = Function::Create(
       oldF->getFunctionType(), oldF->getLinkage(),
       oldF->getName(), oldF->getParent());
 
-  ValueToValueMapTy mapArgs; // Create Val2Val mapping and clone function
+  // Create Val2Val mapping and clone function
   Function::arg_iterator newArgumentI = newF->arg_begin();
   Function::arg_iterator oldArgumentI = oldF->arg_begin();
   for (; oldArgumentI != oldF->arg_end() ; oldArgumentI++, newArgumentI++) {
@@ -498,31 +2267,37 @@ Function* TaffoInitializer::createFunctionAndQueue(llvm::CallSite *call, ConvQue
     mapArgs.insert(std::make_pair(oldArgumentI, newArgumentI));
   }
   SmallVector<ReturnInst*,100> returns;
-  CloneFunctionInto(newF, oldF, mapArgs, true, returns);
+  /* Module level changes are needed only to give the clone its own debug
+   * info. Otherwise they make the mapper visit (and record in the map) every
+   * constant and every metadata node used by the function. */
+  CloneFunctionInto(newF, oldF, mapArgs, oldF->getSubprogram() != nullptr, returns);
   newF->setLinkage(GlobalVariable::LinkageTypes::InternalLinkage);
   FunctionCloned++;
+  ClonedInstructions += newF->getInstructionCount();
+  if (memoryAccounting)
+    memoryAccounting->add(MemoryAccounting::CloneIR, newF->getInstructionCount(),
+                          MemoryAccounting::estimateIRSize(*newF));
 
   ConvQueueT roots;
   oldArgumentI = oldF->arg_begin();
   newArgumentI = newF->arg_begin();
   LLVM_DEBUG(dbgs() << "Create function from " << oldF->getName() << " to " << newF->getName() << "\n");
-  LLVM_DEBUG(dbgs() << "  callsite instr " << *call->getInstruction() << " [" << call->getInstruction()->getFunction()->getName() << "]\n");
   for (int i=0; oldArgumentI != oldF->arg_end() ; oldArgumentI++, newArgumentI++, i++) {
-    Value *callOperand = call->getInstruction()->getOperand(i);
-    Value *allocaOfArgument = newArgumentI->user_begin()->getOperand(1);
-    if (!isa<AllocaInst>(allocaOfArgument))
-      allocaOfArgument = nullptr;
-    
-    if (!vals.count(callOperand)) {
+    if (!argInfo[i]) {
       LLVM_DEBUG(dbgs() << "  Arg nr. " << i << " skipped, callOperand has no valueInfo\n");
       continue;
     }
+    Value *allocaOfArgument = nullptr;
+    if (!newArgumentI->user_empty())
+      allocaOfArgument = newArgumentI->user_begin()->getOperand(1);
+    if (allocaOfArgument && !isa<AllocaInst>(allocaOfArgument))
+      allocaOfArgument = nullptr;
   
-    ValueInfo& callVi = vals[callOperand];
+    const ValueInfo& callVi = *argInfo[i];
     
     ValueInfo& argumentVi = vals.insert(vals.end(), newArgumentI, ValueInfo()).first->second;
     // Mark the argument itself (set it as a new root as well in VRA-less mode)
-    argumentVi.metadata.reset(callVi.metadata->clone());
+    argumentVi.metadata = callVi.metadata;
     argumentVi.fixpTypeRootDistance = std::max(callVi.fixpTypeRootDistance, callVi.fixpTypeRootDistance+1);
     if (!allocaOfArgument) {
       roots.push_back(newArgumentI, argumentVi);
@@ -532,7 +2307,7 @@ Function* TaffoInitializer::createFunctionAndQueue(llvm::CallSite *call, ConvQue
       ValueInfo& allocaVi = vals.insert(vals.end(), allocaOfArgument, ValueInfo()).first->second;
       // Mark the alloca used for the argument (in O0 opt lvl)
       // let it be a root in VRA-less mode
-      allocaVi.metadata.reset(callVi.metadata->clone());
+      allocaVi.metadata = callVi.metadata;
       allocaVi.fixpTypeRootDistance = std::max(callVi.fixpTypeRootDistance, callVi.fixpTypeRootDistance+2);
       roots.push_back(allocaOfArgument, allocaVi);
     }
@@ -544,18 +2319,24 @@ Function* TaffoInitializer::createFunctionAndQueue(llvm::CallSite *call, ConvQue
   }
 
   ConvQueueT tmpVals;
-  roots.insert(roots.begin(), global.begin(), global.end());
+  /* The annotation calls which are still in oldF are mapped into the clone,
+   * instead of scanning it again */
   ConvQueueT localFix;
-  readLocalAnnotations(*newF, localFix);
+  auto annotations = localAnnotationCalls.find(oldF);
+  if (annotations != localAnnotationCalls.end()) {
+    for (WeakVH& oldCall: annotations->second) {
+      if (!oldCall)
+        continue;
+      CallInst *newCall = cast<CallInst>(mapArgs.lookup(oldCall));
+      parseAnnotation(localFix, cast<ConstantExpr>(newCall->getOperand(1)), newCall->getOperand(0));
+    }
+  }
   roots.insert(roots.begin(), localFix.begin(), localFix.end());
-  buildConversionQueueForRootValues(roots, tmpVals);
-  for (auto val: tmpVals){
+  buildConversionQueueForClone(newF, roots, vals, tmpVals);
+  for (auto& val: tmpVals){
     if (Instruction *inst = dyn_cast<Instruction>(val.first)) {
-      if (inst->getFunction()==newF){
-        vals.push_back(val);
-        convQueue.push_back(val.first);
-        LLVM_DEBUG(dbgs() << "  enqueued " << *inst << " in " << newF->getName() << "\n");
-      }
+      vals.push_back(val.first, std::move(val.second));
+      LLVM_DEBUG(dbgs() << "  enqueued " << *inst << " in " << newF->getName() << "\n");
     }
   }
 
@@ -568,7 +2349,7 @@ void TaffoInitializer::printConversionQueue(ConvQueueT& vals)
 {
   if (vals.size() < 1000) {
     dbgs() << "conversion queue:\n";
-    for (auto val: vals) {
+    for (auto& val: vals) {
       dbgs() << "bt=" << val.second.backtrackingDepthLeft << " ";
       dbgs() << "md=" << val.second.metadata->toString() << " ";
     }
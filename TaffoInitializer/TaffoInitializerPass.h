@@ -1,17 +1,29 @@
 #include <limits>
 #include "llvm/IR/CallSite.h"
 #include "llvm/Pass.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassPlugin.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/Optional.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Hashing.h"
 #include "llvm/IR/ValueMap.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Support/CommandLine.h"
-#include "MultiValueMap.h"
+#include "BacktrackingSlicer.h"
+#include "ConversionQueue.h"
+#include "AnnotationSummary.h"
+#include "MDInfoStore.h"
+#include "MemoryAccounting.h"
 #include "InputInfo.h"
 
 
@@ -25,49 +37,323 @@
 
 STATISTIC(AnnotationCount, "Number of valid annotations found");
 STATISTIC(FunctionCloned, "Number of fixed point function inserted");
+STATISTIC(ConversionQueueSize, "Number of values in the final conversion queue");
+STATISTIC(PropagationVisits, "Number of values visited while building the conversion queue");
+STATISTIC(PropagationRounds, "Number of rounds of the partitioned propagation");
+STATISTIC(PropagationQueueMoves, "Number of values moved within the conversion queue");
+STATISTIC(BacktrackingEnqueues, "Number of operands enqueued by backtracking");
+STATISTIC(FloatIrrelevantPruned, "Number of users not enqueued because they do not carry floating point data");
+STATISTIC(ClonedInstructions, "Number of instructions in the function clones");
+STATISTIC(AnnotationCacheHits, "Number of annotations whose string was already parsed");
+STATISTIC(AnnotationCacheMisses, "Number of distinct annotation strings parsed");
+STATISTIC(FunctionCloneReused, "Number of calls redirected to an already existing function clone");
+STATISTIC(RecursiveCallsBound, "Number of recursive calls bound to the clone of their SCC being specialized");
+STATISTIC(RecursiveSpecializationRounds, "Number of times the clones of a recursive SCC were rebuilt from joined argument info");
+STATISTIC(DeadFunctionsRemoved, "Number of unreferenced originals and clones removed");
+STATISTIC(DeadInstructionsRemoved, "Number of instructions in the removed functions");
+STATISTIC(MDInfoAllocated, "Number of distinct metadata objects allocated");
+STATISTIC(MDInfoShared, "Number of metadata objects shared instead of copied");
+STATISTIC(MDInfoCloned, "Number of metadata objects cloned");
+STATISTIC(MDInfoArenaBytes, "Bytes of the arena of the interned metadata objects and target names");
+STATISTIC(MDNodesBuilt, "Number of distinct metadata nodes built for the emitted info");
+STATISTIC(MDNodesReused, "Number of info attachments which reused an existing metadata node");
+STATISTIC(FunctionArgsMetadataSkipped, "Number of functions without info about their arguments");
+STATISTIC(InitCacheHits, "Number of function propagation rounds replayed from the initializer cache");
+STATISTIC(InitCacheMisses, "Number of function propagation rounds not found in the initializer cache");
+STATISTIC(SummaryRootsImported, "Number of roots imported from the summaries of other modules");
+STATISTIC(SummaryClonesRequested, "Number of clones of functions of other modules requested in the summary");
+STATISTIC(SummaryCallsRedirected, "Number of calls redirected to clones defined by other modules");
+STATISTIC(SummaryClonesExported, "Number of clones defined for the calls of other modules");
+STATISTIC(InitCacheSkipped, "Number of function propagation rounds which can not be cached");
 
 
 namespace taffo {
 
+/* The metadata and the target are owned by the MDInfoStore of the run, and
+ * they live as long as the store (which is kept by the InitializerResult).
+ * Therefore ValueInfo is trivially copyable. */
 struct ValueInfo {
   unsigned int backtrackingDepthLeft = 0;
   unsigned int fixpTypeRootDistance = UINT_MAX;
 
-  std::shared_ptr<mdutils::MDInfo> metadata;
-  llvm::Optional<std::string> target;
+  /* interned in the MDInfoStore, must not be modified */
+  mdutils::MDInfo *metadata = nullptr;
+  /* interned in the MDInfoStore, nullptr if the value has no target */
+  const char *target = nullptr;
+};
+
+
+/* Contents of an annotation string, parsed once per module and shared by
+ * all the annotations which refer to the same string global. */
+struct ParsedAnnotation {
+  bool valid = false;
+  /* as returned by the parser, released once interned */
+  std::shared_ptr<mdutils::MDInfo> parsedMetadata;
+  llvm::Optional<std::string> parsedTarget;
+  /* interned in the MDInfoStore when the annotation is cached */
+  mdutils::MDInfo *metadata = nullptr;
+  const char *target = nullptr;
+  bool backtracking = false;
+  unsigned int backtrackingDepth = 0;
+  bool startingPoint = false;
+  /* syntax error message, reported when the annotation is cached */
+  std::string error;
+};
+
+
+/* Local annotations found by the discovery phase. The calls and the distinct
+ * annotation strings are collected serially in module order; only the
+ * strings, which are independent from each other, are parsed concurrently. */
+struct LocalAnnotationScan {
+  /* the llvm.var.annotation calls of each function, in instruction order */
+  std::vector<std::pair<llvm::Function *, llvm::SmallVector<llvm::CallInst *, 8>>> calls;
+  /* the annotation strings which were not cached yet, in order of first use */
+  std::vector<llvm::GlobalVariable *> pending;
+  /* the strings of pending which no call has used yet */
+  llvm::SmallPtrSet<llvm::GlobalVariable *, 16> fresh;
+};
+
+
+struct PropagationPartition;
+class InitializerCache;
+
+
+/* A clone of a function, specialized for the metadata of its arguments.
+ * The signature is a structural encoding of the metadata of each argument. */
+struct FunctionSpecialization {
+  llvm::hash_code hash;
+  std::string signature;
+  llvm::Function *clone;
+  /* info of the returned values, joined; no metadata if they have none */
+  ValueInfo ret;
+};
+
+
+/* Clone of a function of a recursive SCC which is being specialized along the
+ * current chain of calls. The recursive calls reaching the function join the
+ * info of their arguments into joined, and the clone is rebuilt from it until
+ * it does not change anymore. */
+struct ActiveSpecialization {
+  llvm::Function *clone;
+  std::vector<llvm::Optional<ValueInfo>> joined;
+};
+
+
+/* Final result of the initializer: the info of every value in the conversion
+ * queue, and the function clones. The same info is attached to the IR as
+ * metadata, unless disabled by -taffo-init-metadata=false. With the new pass
+ * manager it is available through InitializerAnalysis. */
+struct InitializerResult {
+  llvm::DenseMap<const llvm::Value *, ValueInfo> values;
+  /* clones of each function, and original function of each clone */
+  llvm::DenseMap<const llvm::Function *, llvm::SmallVector<llvm::Function *, 2>> clones;
+  llvm::DenseMap<const llvm::Function *, llvm::Function *> originals;
+  /* number of values pulled in by each root with backtracking enabled */
+  llvm::DenseMap<const llvm::Value *, unsigned int> backtrackingSlices;
+  /* owner of the metadata and of the targets of the values */
+  std::shared_ptr<MDInfoStore> store;
+
+  /* Returns nullptr if v has no info */
+  const ValueInfo *lookup(const llvm::Value *v) const;
+  void clear();
+};
+
+
+/* Holds the result of the last run of TaffoInitializerPass on a module.
+ * It is shared by the pass, which publishes the result, and by
+ * InitializerAnalysis, which provides it to the passes which run later. The
+ * published result is immutable. */
+class InitializerResultHolder {
+  std::shared_ptr<const InitializerResult> current;
+
+public:
+  void publish(InitializerResult&& result) {
+    current = std::make_shared<const InitializerResult>(std::move(result));
+  }
+  std::shared_ptr<const InitializerResult> get() const {
+    return current;
+  }
+  /* Drops the result if it is still the published one */
+  void drop(const std::shared_ptr<const InitializerResult>& result) {
+    if (current == result)
+      current.reset();
+  }
+};
+
+
+/* Provides the result of TaffoInitializerPass to the passes which run after
+ * it. The analysis can not recompute the result, it reads the one published
+ * in the holder. The result is dropped from the holder when the analysis is
+ * invalidated, because it no longer matches the module: the passes which
+ * keep the info up to date must preserve the analysis. */
+class InitializerAnalysis : public llvm::AnalysisInfoMixin<InitializerAnalysis> {
+  friend llvm::AnalysisInfoMixin<InitializerAnalysis>;
+  static llvm::AnalysisKey Key;
+  std::shared_ptr<InitializerResultHolder> holder;
+
+public:
+  class Result {
+    std::shared_ptr<InitializerResultHolder> holder;
+    std::shared_ptr<const InitializerResult> result;
+
+  public:
+    Result(std::shared_ptr<InitializerResultHolder> holder,
+           std::shared_ptr<const InitializerResult> result):
+        holder(std::move(holder)), result(std::move(result)) {}
+
+    /* false if the initializer did not run on the module, or if its result
+     * was invalidated since */
+    bool isAvailable() const {
+      return result != nullptr;
+    }
+    /* Only valid if isAvailable() */
+    const InitializerResult& get() const {
+      assert(result && "the result of the initializer is not available");
+      return *result;
+    }
+    bool invalidate(llvm::Module &M, const llvm::PreservedAnalyses &PA,
+                    llvm::ModuleAnalysisManager::Invalidator &Inv);
+  };
+
+  InitializerAnalysis(std::shared_ptr<InitializerResultHolder> holder): holder(std::move(holder)) {}
+  Result run(llvm::Module &M, llvm::ModuleAnalysisManager &AM);
+};
+
+
+/* Kinds of changes made to the module, used to compute which analyses are
+ * preserved. */
+struct InitializerChanges {
+  /* metadata or function attributes were modified */
+  bool metadata = false;
+  /* instructions were removed (annotation calls) */
+  bool instructions = false;
+  /* functions were cloned or calls were redirected to clones */
+  bool callGraph = false;
+
+  bool any() const {
+    return metadata || instructions || callGraph;
+  }
 };
 
 
 struct TaffoInitializer : public llvm::ModulePass {
   static char ID;
   
-  using ConvQueueT = MultiValueMap<llvm::Value *, ValueInfo>;
+  using ConvQueueT = ConversionQueue<llvm::Value *, ValueInfo>;
+  /* clones being specialized along the current chain of calls */
+  using ActiveClonesT = llvm::DenseMap<llvm::Function *, ActiveSpecialization>;
   
   llvm::SmallPtrSet<llvm::Function *, 32> enabledFunctions;
+  llvm::DenseMap<llvm::GlobalVariable *, ParsedAnnotation> annotationCache;
+  llvm::DenseMap<llvm::Function *, std::vector<FunctionSpecialization>> specializations;
+  /* top-down index of the call graph SCC of each original function */
+  llvm::DenseMap<llvm::Function *, unsigned int> sccOrder;
+  /* the clones created so far with their originals, in order of creation */
+  std::vector<std::pair<llvm::Function *, llvm::Function *>> createdClones;
+  /* the llvm.var.annotation calls of each function */
+  llvm::DenseMap<llvm::Function *, llvm::SmallVector<llvm::WeakVH, 4>> localAnnotationCalls;
+  /* created for each run, and then handed to the result */
+  std::shared_ptr<MDInfoStore> mdInfoStore;
+  BacktrackingSlicer backtrackingSlicer;
+  InitializerChanges changes;
+  InitializerResult result;
+  /* only exists when -taffo-init-cache-dir is given */
+  std::unique_ptr<InitializerCache> cache;
+  /* hash of the parts of the module which are not in the functions but
+   * affect their propagation (the struct types) */
+  std::string cacheModuleKey;
+  /* info of the annotated functions, which is the info of their return value */
+  llvm::DenseMap<llvm::Function *, ValueInfo> functionAnnotations;
+  /* only exists when -taffo-init-summary-out is given */
+  std::unique_ptr<AnnotationSummary> summary;
+  /* merge of the summaries given by -taffo-init-summary-in */
+  std::unique_ptr<AnnotationSummary> importedSummary;
+  /* only exists when -taffo-init-memory-report is given */
+  std::unique_ptr<MemoryAccounting> memoryAccounting;
+  /* only exists when the propagation through memory or the summaries are
+   * enabled */
+  std::unique_ptr<llvm::TargetLibraryInfoImpl> targetLibraryInfo;
+  /* analyses of the functions, only with the new pass manager */
+  llvm::FunctionAnalysisManager *functionAnalyses = nullptr;
+  /* files written by a run, initialized from -taffo-init-summary-out and
+   * -taffo-init-memory-report (empty = not written) */
+  std::string summaryOutPath;
+  std::string memoryReportPath;
+  /* false when other modules are initialized concurrently in the process,
+   * whose allocations would be counted in the malloc usage of the report */
+  bool memoryReportMalloc = true;
   
-  TaffoInitializer(): ModulePass(ID) { }
+  TaffoInitializer();
+  ~TaffoInitializer();
+  void getAnalysisUsage(llvm::AnalysisUsage &AU) const override;
+  void releaseMemory() override;
   bool runOnModule(llvm::Module &M) override;
+  bool runOnModuleImpl(llvm::Module &M, llvm::CallGraph &CG);
   
   void readGlobalAnnotations(llvm::Module &m, ConvQueueT& res, bool functionAnnotation = false);
   void readLocalAnnotations(llvm::Function &f, ConvQueueT& res);
   void readAllLocalAnnotations(llvm::Module &m, ConvQueueT& res);
+  void scanLocalAnnotations(llvm::Function &f, LocalAnnotationScan& res) const;
+  void parseLocalAnnotations(LocalAnnotationScan& scan);
+  void mergeLocalAnnotations(llvm::Function &f, llvm::ArrayRef<llvm::CallInst *> calls, LocalAnnotationScan& scan, ConvQueueT& res);
+  static ParsedAnnotation parseAnnotationContent(llvm::GlobalVariable *annoContent);
+  const ParsedAnnotation *cacheParsedAnnotation(llvm::GlobalVariable *annoContent, ParsedAnnotation&& parsed);
+  const ParsedAnnotation *getParsedAnnotation(llvm::GlobalVariable *annoContent);
   bool parseAnnotation(ConvQueueT& res, llvm::ConstantExpr *annoPtrInst, llvm::Value *instr, bool *isTarget = nullptr);
+  bool parseAnnotation(ConvQueueT& res, const ParsedAnnotation *parsed, llvm::Value *instr, bool *isTarget = nullptr);
   void removeNoFloatTy(ConvQueueT& res);
   void printAnnotatedObj(llvm::Module &m);
   
+  static unsigned int getThreadCount();
+  
   void buildConversionQueueForRootValues(const ConvQueueT& val, ConvQueueT& res);
+  void buildConversionQueueForClone(llvm::Function *f, const ConvQueueT& roots, const ConvQueueT& vals, ConvQueueT& res);
+  void prepareFunctionPartition(PropagationPartition& P);
+  void runFunctionPartition(PropagationPartition& P);
+  void finishPartition(PropagationPartition& P);
+  void propagatePartition(PropagationPartition& P);
+  bool replayPartition(PropagationPartition& P);
+  void storePartition(PropagationPartition& P);
+  void computeCacheModuleKey(llvm::Module &m);
+  void clearRunState();
+  void accountMemory(const ConvQueueT& queue);
+  void writeMemoryReport(llvm::Module &m);
+  void propagateForward(PropagationPartition& P, llvm::Value *v, const ValueInfo& vinfo, llvm::Value *u);
+  void propagateBackward(PropagationPartition& P, llvm::Value *v, const ValueInfo& vinfo, llvm::Value *u, ConvQueueT::iterator next);
+  void propagateThroughMemory(PropagationPartition& P, llvm::StoreInst *store, ConvQueueT::iterator next);
   void createInfoOfUser(llvm::Value *used, const ValueInfo& VIUsed, llvm::Value *user, ValueInfo& VIUser);
-  std::shared_ptr<mdutils::MDInfo> extractGEPIMetadata(const llvm::Value *user,
-						       const llvm::Value *used,
-						       std::shared_ptr<mdutils::MDInfo> user_mdi,
-						       std::shared_ptr<mdutils::MDInfo> used_mdi);
-  void generateFunctionSpace(ConvQueueT& vals, ConvQueueT& global, llvm::SmallPtrSet<llvm::Function *, 10> &callTrace);
-  llvm::Function *createFunctionAndQueue(llvm::CallSite *call, ConvQueueT& vals, ConvQueueT& global, std::vector<llvm::Value*> &convQueue);
+  mdutils::MDInfo *extractGEPIMetadata(const llvm::Value *user,
+				       const llvm::Value *used,
+				       mdutils::MDInfo *user_mdi,
+				       mdutils::MDInfo *used_mdi);
+  void generateFunctionSpace(llvm::Module &m, llvm::CallGraph &cg, ConvQueueT& vals);
+  void specializeCall(llvm::Instruction *call, ConvQueueT& vals, ActiveClonesT &activeClones);
+  const FunctionSpecialization *specializeFunction(llvm::Function *oldF, const std::string& signature,
+                                                   llvm::ArrayRef<const ValueInfo *> argInfo, ConvQueueT& vals,
+                                                   ActiveClonesT &activeClones);
+  llvm::Function *cloneForSpecialization(llvm::Function *oldF, llvm::ArrayRef<const ValueInfo *> argInfo, ConvQueueT& vals);
+  void discardClones(size_t first, llvm::Function *oldF, ConvQueueT& vals);
+  void getReturnInfo(llvm::Function *f, ConvQueueT& vals, ValueInfo& res);
+  void joinValueInfo(ValueInfo& info, const ValueInfo& other);
+  void bindCall(llvm::CallSite& call, llvm::Function *oldF, llvm::Function *clone, const ValueInfo& ret, ConvQueueT& vals);
+  void propagateCallInfo(llvm::Instruction *call, ConvQueueT& vals);
+  llvm::Function *createFunctionAndQueue(llvm::Function *oldF, llvm::ArrayRef<const ValueInfo *> argInfo,
+                                         ConvQueueT& vals, llvm::ValueToValueMapTy &mapArgs);
+  void specializeExternalCall(llvm::CallSite& call, ConvQueueT& vals, const std::string& signature);
+  void importSummaryRoots(llvm::Module &m, ConvQueueT& roots);
+  void importClones(llvm::Module &m, ConvQueueT& vals);
+  void writeSummary(llvm::Module &m, ConvQueueT& vals);
+  bool getCallSignature(llvm::CallSite& call, ConvQueueT& vals, std::string& signature);
+  static void getArgsSignature(llvm::ArrayRef<const ValueInfo *> argInfo, std::string& signature);
+  const FunctionSpecialization *findSpecialization(llvm::Function *oldF, const std::string& signature);
+  void removeDeadFunctions(llvm::Module &m, ConvQueueT& vals);
   void printConversionQueue(ConvQueueT& vals);
   void removeAnnotationCalls(ConvQueueT& vals);
+  void invalidateFunctionAnalyses(llvm::Function *f, bool removed);
   
   void setMetadataOfValue(llvm::Value *v, ValueInfo& VI);
   void setFunctionArgsMetadata(llvm::Module &m, ConvQueueT& Q);
+  void exportResult(ConvQueueT& vals);
 
   bool isSpecialFunction(const llvm::Function* f) {
     llvm::StringRef fName = f->getName();
@@ -76,6 +362,20 @@ struct TaffoInitializer : public llvm::ModulePass {
 };
 
 
+
+/* New pass manager version of TaffoInitializer */
+struct TaffoInitializerPass : public llvm::PassInfoMixin<TaffoInitializerPass> {
+  /* where the result is published, nullptr if it is not needed */
+  std::shared_ptr<InitializerResultHolder> holder;
+
+  TaffoInitializerPass(std::shared_ptr<InitializerResultHolder> holder = nullptr): holder(std::move(holder)) {}
+  llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &AM);
+};
+
+
+llvm::PassPluginLibraryInfo getTaffoInitializerPluginInfo();
+
+
 }
 
 
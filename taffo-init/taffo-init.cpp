@@ -0,0 +1,228 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassTimingInfo.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+#include "TaffoInitializerPass.h"
+#include "AnnotationSummary.h"
+
+
+using namespace llvm;
+using namespace taffo;
+
+
+/* Batch driver of the initializer. Each input module is read, initialized
+ * and written by one of the worker threads, in an LLVMContext of its own:
+ * nothing of a module (named struct types, constants, metadata) leaks into
+ * the next one, so the output does not depend on -j or on the scheduling.
+ * The options of the pass (-taffo-init-*) are accepted and apply to every
+ * module. */
+
+
+static cl::list<std::string> InputFilenames(cl::Positional, cl::OneOrMore,
+    cl::desc("<input .ll/.bc files, or summaries with --thin-link>"));
+static cl::opt<std::string> OutputDir("o",
+    cl::desc("Directory of the output files, named <input stem>.init.bc (.ll with -S)"),
+    cl::value_desc("directory"), cl::init("."));
+static cl::opt<bool> OutputAssembly("S",
+    cl::desc("Write the output modules as LLVM assembly"), cl::init(false));
+static cl::opt<unsigned> Jobs("j",
+    cl::desc("Number of modules processed in parallel (0 = one per core)"), cl::init(0));
+static cl::opt<bool> VerifyOutput("verify",
+    cl::desc("Verify the output modules"), cl::init(true));
+static cl::opt<bool> EmitSummaries("emit-summaries",
+    cl::desc("Write the summary of each module to <output>.summary.json"), cl::init(false));
+static cl::opt<bool> MemoryReports("memory-reports",
+    cl::desc("Write the memory report of each module to <output>.memory.json "
+             "(without the malloc usage, which is process-wide, unless -j1)"), cl::init(false));
+static cl::opt<std::string> ThinLink("thin-link",
+    cl::desc("Merge the input summaries into this file, instead of processing modules"),
+    cl::value_desc("filename"), cl::init(""));
+
+
+namespace {
+
+struct BatchState {
+  std::atomic<size_t> next{0};
+  std::atomic<size_t> failed{0};
+  size_t done = 0;
+  unsigned jobs = 1;
+  /* serializes the diagnostics and the progress lines */
+  std::mutex outputLock;
+};
+
+}
+
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+static std::string getOutputPath(StringRef input)
+{
+  SmallString<128> path(OutputDir);
+  sys::path::append(path, sys::path::stem(input));
+  path += OutputAssembly ? ".init.ll" : ".init.bc";
+  return std::string(path.str());
+}
+
+
+/* Reads, initializes and writes a module. Returns false on failure, after
+ * reporting the reason. */
+static bool processModule(StringRef input, BatchState& state)
+{
+  auto report = [&](const Twine& msg) {
+    std::lock_guard<std::mutex> guard(state.outputLock);
+    errs() << "taffo-init: " << input << ": " << msg << "\n";
+  };
+
+  auto start = std::chrono::steady_clock::now();
+
+  LLVMContext context;
+  SMDiagnostic err;
+  std::unique_ptr<Module> m = parseIRFile(input, err, context);
+  if (!m) {
+    std::string msg;
+    raw_string_ostream os(msg);
+    err.print("taffo-init", os, false);
+    std::lock_guard<std::mutex> guard(state.outputLock);
+    errs() << os.str();
+    return false;
+  }
+
+  std::string output = getOutputPath(input);
+  {
+    TaffoInitializer init;
+    init.summaryOutPath = EmitSummaries ? output + ".summary.json" : "";
+    init.memoryReportPath = MemoryReports ? output + ".memory.json" : "";
+    init.memoryReportMalloc = state.jobs == 1;
+    CallGraph cg(*m);
+    init.runOnModuleImpl(*m, cg);
+  }
+
+  if (VerifyOutput) {
+    std::string msg;
+    raw_string_ostream os(msg);
+    if (verifyModule(*m, &os)) {
+      report("the initialized module is broken\n" + os.str());
+      return false;
+    }
+  }
+
+  std::error_code EC;
+  ToolOutputFile out(output, EC, OutputAssembly ? sys::fs::OF_Text : sys::fs::OF_None);
+  if (EC) {
+    report("can not write " + output + ": " + EC.message());
+    return false;
+  }
+  if (OutputAssembly)
+    m->print(out.os(), nullptr);
+  else
+    WriteBitcodeToFile(*m, out.os());
+  out.keep();
+
+  std::lock_guard<std::mutex> guard(state.outputLock);
+  state.done++;
+  outs() << "[" << state.done << "/" << InputFilenames.size() << "] " << input << " -> " << output
+         << format(" (%.3f s)", secondsSince(start)) << "\n";
+  return true;
+}
+
+
+static int thinLink()
+{
+  AnnotationSummary merged;
+  for (const std::string& input: InputFilenames) {
+    if (!merged.mergeFile(input))
+      return 1;
+  }
+  std::error_code EC;
+  ToolOutputFile out(ThinLink, EC, sys::fs::OF_Text);
+  if (EC) {
+    errs() << "taffo-init: can not write " << ThinLink << ": " << EC.message() << "\n";
+    return 1;
+  }
+  merged.write(out.os());
+  out.keep();
+  return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "TAFFO initializer batch driver\n");
+  /* the statistics of the batch are printed at the end even without -stats */
+  EnableStatistics(false);
+
+  if (!ThinLink.empty())
+    return thinLink();
+
+  /* two inputs with the same stem would overwrite each other's output */
+  StringSet<> outputs;
+  for (const std::string& input: InputFilenames) {
+    if (!outputs.insert(getOutputPath(input)).second) {
+      errs() << "taffo-init: more than one input is written to " << getOutputPath(input) << "\n";
+      return 1;
+    }
+  }
+  if (std::error_code EC = sys::fs::create_directories(OutputDir)) {
+    errs() << "taffo-init: can not create " << OutputDir << ": " << EC.message() << "\n";
+    return 1;
+  }
+
+  unsigned jobs = Jobs;
+  if (jobs == 0)
+    jobs = heavyweight_hardware_concurrency();
+  if (TimePassesIsEnabled && jobs > 1) {
+    /* the timers of the phases are shared by all the runs */
+    errs() << "taffo-init: -time-passes requires a single job, using -j1\n";
+    jobs = 1;
+  }
+  jobs = std::max(1u, std::min<unsigned>(jobs, InputFilenames.size()));
+
+  BatchState state;
+  state.jobs = jobs;
+  auto start = std::chrono::steady_clock::now();
+  auto worker = [&state]() {
+    for (size_t i = state.next++; i < InputFilenames.size(); i = state.next++) {
+      if (!processModule(InputFilenames[i], state))
+        state.failed++;
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < jobs; i++)
+    workers.emplace_back(worker);
+  worker();
+  for (std::thread& t: workers)
+    t.join();
+
+  outs() << "processed " << InputFilenames.size() << " modules, " << state.failed << " failed, with "
+         << jobs << " jobs" << format(" in %.3f s", secondsSince(start)) << "\n";
+  /* the statistics of all the runs are aggregated; they are reset after
+   * being printed, so that -stats does not print them again at exit */
+  PrintStatistics(outs());
+  ResetStatistics();
+  return state.failed ? 1 : 0;
+}
@@ -0,0 +1,59 @@
+; Backtracking through a loop-carried phi.
+; %v is reached from %acc, which has backtracking enabled, and %next from
+; %scale, which is closer to it. When %v backtracks to %next and %init, they
+; follow %v in the conversion queue, therefore they are moved before %v and
+; restarted from the info of %v: both get the range of %acc and
+; taffo.initweight 3. The depth is bounded because with unbounded
+; backtracking the propagation before the worklist never ended on this loop.
+;
+; RUN: opt -load %taffo_plugin -taffoinit -S %s | FileCheck %s
+
+; CHECK-LABEL: define float @accumulate(
+; CHECK: %scale = alloca {{.*}}!taffo.initweight ![[W0:[0-9]+]], !taffo.info ![[SCALE:[0-9]+]]
+; CHECK: %acc = alloca {{.*}}!taffo.initweight ![[W0]], !taffo.info ![[ACC:[0-9]+]]
+; CHECK: %s = load {{.*}}!taffo.initweight ![[W1:[0-9]+]], !taffo.info ![[SCALE]]
+; CHECK: %init = load {{.*}}!taffo.initweight ![[W3:[0-9]+]], !taffo.info ![[ACC]]
+; CHECK: %v = phi {{.*}}!taffo.initweight ![[W2:[0-9]+]], !taffo.info ![[ACC]]
+; CHECK: %next = fmul {{.*}}!taffo.initweight ![[W3]], !taffo.info ![[ACC]]
+; CHECK: store float %next, {{.*}}!taffo.initweight ![[W1]], !taffo.info ![[ACC]]
+; CHECK: ret float %next, !taffo.initweight ![[W3]], !taffo.info ![[SCALE]]
+; CHECK-DAG: ![[W0]] = !{i32 0}
+; CHECK-DAG: ![[W1]] = !{i32 1}
+; CHECK-DAG: ![[W2]] = !{i32 2}
+; CHECK-DAG: ![[W3]] = !{i32 3}
+
+source_filename = "backtracking_phi.ll"
+
+@.str = private unnamed_addr constant [20 x i8] c"scalar(range(0, 1))\00", section "llvm.metadata"
+@.str.1 = private unnamed_addr constant [43 x i8] c"backtracking(3) scalar(range(-1000, 1000))\00", section "llvm.metadata"
+@.str.2 = private unnamed_addr constant [19 x i8] c"backtracking_phi.c\00", section "llvm.metadata"
+
+define float @accumulate(float* %in, i32 %n) {
+entry:
+  %scale = alloca float, align 4
+  %acc = alloca float, align 4
+  %scale1 = bitcast float* %scale to i8*
+  call void @llvm.var.annotation(i8* %scale1, i8* getelementptr inbounds ([20 x i8], [20 x i8]* @.str, i32 0, i32 0), i8* getelementptr inbounds ([19 x i8], [19 x i8]* @.str.2, i32 0, i32 0), i32 3)
+  %acc1 = bitcast float* %acc to i8*
+  call void @llvm.var.annotation(i8* %acc1, i8* getelementptr inbounds ([43 x i8], [43 x i8]* @.str.1, i32 0, i32 0), i8* getelementptr inbounds ([19 x i8], [19 x i8]* @.str.2, i32 0, i32 0), i32 4)
+  %0 = load float, float* %in, align 4
+  store float %0, float* %scale, align 4
+  store float 0.000000e+00, float* %acc, align 4
+  %s = load float, float* %scale, align 4
+  %init = load float, float* %acc, align 4
+  br label %loop
+
+loop:                                             ; preds = %loop, %entry
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %v = phi float [ %init, %entry ], [ %next, %loop ]
+  %next = fmul float %v, %s
+  %i.next = add nsw i32 %i, 1
+  %cmp = icmp slt i32 %i.next, %n
+  br i1 %cmp, label %loop, label %exit
+
+exit:                                             ; preds = %loop
+  store float %next, float* %acc, align 4
+  ret float %next
+}
+
+declare void @llvm.var.annotation(i8*, i8*, i8*, i32)
@@ -0,0 +1,237 @@
+#!/usr/bin/env python3
+"""Generates synthetic LLVM modules for benchmarking the taffoinit pass.
+
+The modules are made of chains of functions calling each other (the length
+of a chain is the call depth). Every function contains annotated local
+variables, an annotated local of a nested struct type, loads and stores of
+annotated globals, and loops with many PHI nodes. The roots use a mix of
+plain ranges, `backtracking` and `force_no_float` annotations.
+
+The output is textual IR with typed pointers, as produced by clang for the
+LLVM version TAFFO is built against. The generation is deterministic for a
+given set of parameters.
+"""
+
+import argparse
+import random
+import sys
+
+
+class ModuleWriter:
+  def __init__(self, args):
+    self.args = args
+    self.rng = random.Random(args.seed)
+    self.strings = {}
+    self.lines = []
+    self.instructions = 0
+    self.global_annotations = []
+
+  def emit(self, line, instruction=True):
+    self.lines.append(line)
+    if instruction:
+      self.instructions += 1
+
+  def string(self, text):
+    """Returns a constant expression pointing to an annotation string."""
+    if text not in self.strings:
+      self.strings[text] = '@.str.%d' % len(self.strings)
+    name = self.strings[text]
+    size = len(text) + 1
+    return ('i8* getelementptr inbounds ([%d x i8], [%d x i8]* %s, i32 0, i32 0)'
+            % (size, size, name))
+
+  def random_range(self):
+    """Picks a range from a pool, so that annotation strings repeat."""
+    if not hasattr(self, 'range_pool'):
+      self.range_pool = [(self.rng.randint(-1000, 0), self.rng.randint(1, 1000))
+                         for _ in range(max(1, self.args.ranges))]
+    return self.rng.choice(self.range_pool)
+
+  def scalar_annotation(self):
+    lo, hi = self.random_range()
+    roll = self.rng.random()
+    if roll < self.args.force_no_float:
+      return 'force_no_float range %d %d' % (lo, hi)
+    roll -= self.args.force_no_float
+    if roll < self.args.backtracking:
+      return 'scalar(range(%d, %d)) backtracking' % (lo, hi)
+    return 'scalar(range(%d, %d))' % (lo, hi)
+
+  def struct_annotation(self, level):
+    lo, hi = self.random_range()
+    field = 'scalar(range(%d, %d))' % (lo, hi)
+    if level == self.args.struct_depth - 1:
+      lo, hi = self.random_range()
+      return 'struct[%s, scalar(range(%d, %d))]' % (field, lo, hi)
+    return 'struct[%s, %s]' % (field, self.struct_annotation(level + 1))
+
+  def annotate_local(self, ptr, ptr_type, annotation, line):
+    self.emit('  %s.i8 = bitcast %s %s to i8*' % (ptr, ptr_type, ptr))
+    self.emit('  call void @llvm.var.annotation(i8* %s.i8, %s, %s, i32 %d)'
+              % (ptr, self.string(annotation), self.string('bench.c'), line))
+
+  def function(self, index, callee):
+    a = self.args
+    self.emit('define double @f%d(double %%x, double* %%out) {' % index, False)
+    self.emit('entry:', False)
+
+    value = '%x'
+    for j in range(a.locals):
+      self.emit('  %%loc%d = alloca double, align 8' % j)
+      self.annotate_local('%%loc%d' % j, 'double*', self.scalar_annotation(), index * 100 + j)
+      self.emit('  store double %s, double* %%loc%d, align 8' % (value, j))
+      self.emit('  %%ld%d = load double, double* %%loc%d, align 8' % (j, j))
+      self.emit('  %%sum%d = fadd double %s, %%ld%d' % (j, value, j))
+      value = '%%sum%d' % j
+
+    if a.struct_depth > 0:
+      self.emit('  %s0 = alloca %struct.s0, align 8')
+      self.annotate_local('%s0', '%struct.s0*', self.struct_annotation(0), index * 100 + 99)
+      ptr = '%s0'
+      for k in range(a.struct_depth):
+        self.emit('  %%sf%d = getelementptr inbounds %%struct.s%d, %%struct.s%d* %s, i32 0, i32 0'
+                  % (k, k, k, ptr))
+        self.emit('  store double %s, double* %%sf%d, align 8' % (value, k))
+        if k < a.struct_depth - 1:
+          self.emit('  %%s%d = getelementptr inbounds %%struct.s%d, %%struct.s%d* %s, i32 0, i32 1'
+                    % (k + 1, k, k, ptr))
+          ptr = '%%s%d' % (k + 1)
+      self.emit('  %%sl = load double, double* %%sf%d, align 8' % (a.struct_depth - 1))
+      self.emit('  %%ssum = fadd double %s, %%sl' % value)
+      value = '%ssum'
+
+    for j in range(min(a.globals, a.global_uses)):
+      g = (index + j) % a.globals
+      self.emit('  %%gl%d = load double, double* @g%d, align 8' % (j, g))
+      self.emit('  %%gsum%d = fmul double %s, %%gl%d' % (j, value, j))
+      value = '%%gsum%d' % j
+
+    pred = 'entry'
+    for k in range(a.loops):
+      self.emit('  br label %%loop%d' % k)
+      self.emit('loop%d:' % k, False)
+      self.emit('  %%iv%d = phi i32 [ 0, %%%s ], [ %%iv%d.next, %%loop%d ]' % (k, pred, k, k))
+      for m in range(a.phis):
+        self.emit('  %%p%d.%d = phi double [ %s, %%%s ], [ %%p%d.%d.next, %%loop%d ]'
+                  % (k, m, value, pred, k, m, k))
+      for m in range(a.phis):
+        op = 'fadd' if m % 2 == 0 else 'fmul'
+        self.emit('  %%p%d.%d.next = %s double %%p%d.%d, %%p%d.%d'
+                  % (k, m, op, k, m, k, (m + 1) % a.phis))
+      self.emit('  %%iv%d.next = add nsw i32 %%iv%d, 1' % (k, k))
+      self.emit('  %%cmp%d = icmp slt i32 %%iv%d.next, 16' % (k, k))
+      self.emit('  br i1 %%cmp%d, label %%loop%d, label %%exit%d' % (k, k, k))
+      self.emit('exit%d:' % k, False)
+      value = '%%p%d.0.next' % k
+      pred = 'exit%d' % k
+
+    if callee is not None:
+      arg = '%loc0' if a.locals > 0 else '%out'
+      self.emit('  %%call = call double @f%d(double %s, double* %s)' % (callee, value, arg))
+      self.emit('  %%res = fadd double %s, %%call' % value)
+      value = '%res'
+    if a.globals > 0:
+      self.emit('  store double %s, double* @g%d, align 8' % (value, index % a.globals))
+    self.emit('  store double %s, double* %%out, align 8' % value)
+    self.emit('  ret double %s' % value)
+    self.emit('}', False)
+    self.emit('', False)
+
+  def module(self):
+    a = self.args
+    body = self.lines
+
+    for k in range(a.struct_depth):
+      tail = 'double' if k == a.struct_depth - 1 else '%%struct.s%d' % (k + 1)
+      self.emit('%%struct.s%d = type { double, %s }' % (k, tail), False)
+    self.emit('', False)
+
+    for g in range(a.globals):
+      self.emit('@g%d = global double 0.000000e+00, align 8' % g, False)
+      self.global_annotations.append(('double* @g%d' % g, self.scalar_annotation(), g))
+    self.emit('@sink = global double 0.000000e+00, align 8', False)
+    self.emit('', False)
+
+    header = len(self.lines)
+    chain = max(1, a.call_depth)
+    heads = []
+    for i in range(a.functions):
+      last_in_chain = i % chain == chain - 1 or i == a.functions - 1
+      if i % chain == 0:
+        heads.append(i)
+      self.function(i, None if last_in_chain else i + 1)
+
+    self.emit('define i32 @main() {', False)
+    self.emit('entry:', False)
+    for n, h in enumerate(heads):
+      self.emit('  %%r%d = call double @f%d(double 1.000000e+00, double* @sink)' % (n, h))
+    self.emit('  ret i32 0')
+    self.emit('}', False)
+    self.emit('', False)
+    self.emit('declare void @llvm.var.annotation(i8*, i8*, i8*, i32)', False)
+    self.emit('', False)
+
+    # the strings and the global annotations are known only at the end
+    tail = []
+    file_ref = self.string('bench.c')
+    entries = []
+    for ref, annotation, line in self.global_annotations:
+      entries.append('{ i8*, i8*, i8*, i32 } { i8* bitcast (%s to i8*), %s, %s, i32 %d }'
+                     % (ref, self.string(annotation), file_ref, line))
+    for text, name in sorted(self.strings.items(), key=lambda kv: int(kv[1][6:])):
+      tail.append('%s = private unnamed_addr constant [%d x i8] c"%s\\00", section "llvm.metadata"'
+                  % (name, len(text) + 1, text))
+    if entries:
+      tail.append('@llvm.global.annotations = appending global [%d x { i8*, i8*, i8*, i32 }] [%s], section "llvm.metadata"'
+                  % (len(entries), ', '.join(entries)))
+    tail.append('')
+    self.lines = body[:header] + tail + body[header:]
+
+    prologue = ['; generated by gen_module.py %s' % ' '.join(sys.argv[1:]),
+                '; instructions: %d' % self.instructions,
+                'source_filename = "bench.c"',
+                '']
+    return '\n'.join(prologue + self.lines)
+
+
+def parse_args(argv=None):
+  parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+  parser.add_argument('--functions', type=int, default=10, help='number of functions')
+  parser.add_argument('--locals', type=int, default=4, help='annotated scalar locals per function')
+  parser.add_argument('--globals', type=int, default=4, help='annotated global variables')
+  parser.add_argument('--global-uses', type=int, default=2, help='globals loaded by each function')
+  parser.add_argument('--call-depth', type=int, default=4, help='length of the chains of calls')
+  parser.add_argument('--struct-depth', type=int, default=2, help='nesting of the annotated struct local (0 = none)')
+  parser.add_argument('--loops', type=int, default=2, help='loops per function')
+  parser.add_argument('--phis', type=int, default=4, help='floating point PHI nodes per loop')
+  parser.add_argument('--backtracking', type=float, default=0.2, help='fraction of roots with backtracking')
+  parser.add_argument('--force-no-float', type=float, default=0.1, help='fraction of roots with force_no_float')
+  parser.add_argument('--ranges', type=int, default=16, help='number of distinct ranges used by the annotations')
+  parser.add_argument('--seed', type=int, default=0)
+  parser.add_argument('-o', '--output', default='-', help='output file (default: stdout)')
+  args = parser.parse_args(argv)
+  if args.phis < 1:
+    parser.error('at least one PHI per loop is required')
+  return args
+
+
+def generate(args):
+  """Returns the text of the module and its number of instructions."""
+  writer = ModuleWriter(args)
+  text = writer.module()
+  return text, writer.instructions
+
+
+def main():
+  args = parse_args()
+  text, count = generate(args)
+  if args.output == '-':
+    sys.stdout.write(text)
+  else:
+    with open(args.output, 'w') as f:
+      f.write(text)
+  sys.stderr.write('%d instructions\n' % count)
+
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,115 @@
+#include <chrono>
+#include <string>
+#include <vector>
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "AnnotationParser.h"
+
+
+using namespace llvm;
+using namespace taffo;
+
+
+/* Microbenchmark of the AnnotationParser. The annotation strings are parsed
+ * once to check that they are valid, then repeatedly, and the throughput of
+ * the fastest run is reported in annotations per second. The time includes
+ * the construction of the parsed metadata, which the pass needs anyway. */
+
+
+static cl::opt<std::string> InputFilename(cl::Positional,
+    cl::desc("[file with one annotation string per line (default: built-in set)]"), cl::init(""));
+static cl::opt<unsigned> Iterations("n",
+    cl::desc("Number of passes over the annotation strings in each run"), cl::init(100000));
+static cl::opt<unsigned> Repeat("repeat",
+    cl::desc("Number of runs, the fastest one is kept"), cl::init(5));
+
+
+/* Both syntaxes, with the shapes found in the TAFFO benchmarks */
+static const char *const DefaultAnnotations[] = {
+  "range -3.1416 3.1416",
+  "range 0 255 0.5",
+  "no_float range -1.0 2.0",
+  "force_no_float range -1e3 1e3 1e-8",
+  "target:result no_float range 0 1000",
+  "scalar()",
+  "scalar(range(-10, 10))",
+  "scalar(range(0, 1) final)",
+  "scalar(type(signed 32 16) range(-32768, 32767) error(1e-6))",
+  "scalar(type(unsigned 16 8)) backtracking",
+  "scalar(disabled range(-1, 1))",
+  "target('out') scalar(range(-1e4, 1e4))",
+  "errtarget('err@'s') scalar(range(0, 100) error(0.01))",
+  "backtracking(3) scalar(range(-2.5e-3, 2.5e-3))",
+  "backtracking(false) scalar(range(16, 256))",
+  "struct[scalar(range(0, 1)), void, scalar(range(-5, 5) final)]",
+  "struct[struct[scalar(range(0, 1)), scalar()], void, struct[void, scalar(type(signed 32 24))]]",
+  "target('matrix') struct[scalar(range(-100, 100)), scalar(range(-100, 100)), void]",
+};
+
+
+int main(int argc, char **argv)
+{
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "annotation parser microbenchmark\n");
+
+  std::unique_ptr<MemoryBuffer> input;
+  std::vector<StringRef> annotations;
+  if (InputFilename.empty()) {
+    for (const char *ann: DefaultAnnotations)
+      annotations.push_back(ann);
+  } else {
+    auto buf = MemoryBuffer::getFileOrSTDIN(InputFilename);
+    if (!buf) {
+      errs() << "parser-bench: can not read " << InputFilename << ": " << buf.getError().message() << "\n";
+      return 1;
+    }
+    input = std::move(*buf);
+    SmallVector<StringRef, 64> lines;
+    input->getBuffer().split(lines, '\n', -1, false);
+    for (StringRef line: lines) {
+      line = line.trim();
+      if (!line.empty())
+        annotations.push_back(line);
+    }
+  }
+  if (Iterations == 0 || Repeat == 0) {
+    errs() << "parser-bench: -n and -repeat must be positive\n";
+    return 1;
+  }
+  if (annotations.empty()) {
+    errs() << "parser-bench: no annotation strings\n";
+    return 1;
+  }
+
+  AnnotationParser parser;
+  for (StringRef ann: annotations) {
+    if (!parser.parseAnnotationString(ann)) {
+      errs() << "parser-bench: \"" << ann << "\": " << parser.lastError() << "\n";
+      return 1;
+    }
+  }
+
+  double best = 0;
+  uint64_t parsed = 0;
+  for (unsigned r = 0; r < Repeat; r++) {
+    parsed = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < Iterations; i++) {
+      for (StringRef ann: annotations)
+        parsed += parser.parseAnnotationString(ann) && parser.metadata;
+    }
+    double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (r == 0 || time < best)
+      best = time;
+  }
+
+  outs() << "parsed " << parsed << " annotations (" << annotations.size() << " distinct)"
+         << format(" in %.3f s: %.0f annotations/s, %.1f ns/annotation\n",
+                   best, parsed / best, best * 1e9 / parsed);
+  return 0;
+}
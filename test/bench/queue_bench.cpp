@@ -0,0 +1,230 @@
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/raw_ostream.h"
+#include "ConversionQueue.h"
+
+#if defined(__has_include)
+#if __has_include("MultiValueMap.h")
+#include "MultiValueMap.h"
+#define HAVE_MULTIVALUEMAP 1
+#endif
+#endif
+
+
+using namespace llvm;
+using namespace taffo;
+
+
+/* Microbenchmark of the conversion queue. The operations are those of the
+ * propagation worklist: a user is appended or moved to the back, an operand
+ * is inserted or moved before the value which backtracks to it (after
+ * checking whether it already precedes it), and some values are erased, as
+ * the annotation calls are. The same sequence of operations is run on
+ * ConversionQueue and, when TaffoUtils provides it, on MultiValueMap with the
+ * find/erase/push_back sequences which the propagation used before. */
+
+
+static cl::opt<std::string> Sizes("sizes",
+    cl::desc("Comma separated numbers of values in the queue"), cl::init("100000,1000000"));
+static cl::opt<unsigned> OpsPerValue("ops",
+    cl::desc("Number of operations per value in the queue"), cl::init(4));
+static cl::opt<unsigned> Repeat("repeat",
+    cl::desc("Number of runs, the fastest one is kept"), cl::init(3));
+static cl::opt<bool> Baseline("baseline",
+    cl::desc("Also time MultiValueMap (only if built with TaffoUtils)"), cl::init(true));
+
+
+namespace {
+
+/* Stand-in for the ValueInfo of the pass, with the same size, so that the
+ * benchmark only depends on the queue */
+struct ValueInfo {
+  unsigned int backtrackingDepthLeft = 0;
+  unsigned int fixpTypeRootDistance = UINT_MAX;
+  void *metadata = nullptr;
+  const char *target = nullptr;
+};
+
+
+enum OpKind { Forward, Backward, Erase };
+
+struct Op {
+  OpKind kind;
+  unsigned value;
+  /* the value which backtracks, for Backward */
+  unsigned user;
+};
+
+
+/* Deterministic mix: 60% forward, 30% backward, 10% erase. Keys are drawn
+ * from twice the size of the queue, so that some of them are new. */
+std::vector<Op> makeOps(unsigned size, unsigned count)
+{
+  uint64_t state = 0x9e3779b97f4a7c15ULL ^ size;
+  auto next = [&state]() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+  };
+  std::vector<Op> ops;
+  ops.reserve(count);
+  for (unsigned i = 0; i < count; i++) {
+    unsigned r = next() % 10;
+    Op op;
+    op.kind = r < 6 ? Forward : (r < 9 ? Backward : Erase);
+    op.value = next() % (2 * size);
+    op.user = next() % size;
+    ops.push_back(op);
+  }
+  return ops;
+}
+
+
+/* Returns the checksum of the final order, so that both queues can be
+ * compared and the work can not be optimized away */
+uint64_t runConversionQueue(unsigned size, const std::vector<Op>& ops)
+{
+  ConversionQueue<unsigned, ValueInfo> queue;
+  for (unsigned i = 0; i < size; i++)
+    queue.push_back(i, ValueInfo());
+
+  for (const Op& op: ops) {
+    auto UI = queue.find(op.value);
+    if (op.kind == Forward) {
+      if (UI == queue.end())
+        queue.push_back(op.value, ValueInfo());
+      else
+        queue.moveToBack(UI);
+    } else if (op.kind == Backward) {
+      auto next = queue.find(op.user);
+      if (next == queue.end() || op.user == op.value)
+        continue;
+      if (UI == queue.end())
+        queue.insert(next, op.value, ValueInfo());
+      else if (!(UI < next))
+        queue.move(UI, next);
+    } else if (UI != queue.end()) {
+      queue.erase(UI);
+    }
+  }
+
+  uint64_t sum = 0;
+  for (auto& I: queue)
+    sum = sum * 31 + I.first;
+  return sum;
+}
+
+
+#ifdef HAVE_MULTIVALUEMAP
+uint64_t runMultiValueMap(unsigned size, const std::vector<Op>& ops)
+{
+  MultiValueMap<unsigned, ValueInfo> queue;
+  for (unsigned i = 0; i < size; i++)
+    queue.push_back(i, ValueInfo());
+
+  for (const Op& op: ops) {
+    auto UI = queue.find(op.value);
+    if (op.kind == Forward) {
+      ValueInfo info;
+      if (UI != queue.end()) {
+        info = UI->second;
+        queue.erase(UI);
+      }
+      queue.push_back(op.value, std::move(info));
+    } else if (op.kind == Backward) {
+      auto next = queue.find(op.user);
+      if (next == queue.end() || op.user == op.value)
+        continue;
+      if (UI != queue.end()) {
+        if (UI < next)
+          continue;
+        queue.erase(UI);
+        next = queue.find(op.user);
+      }
+      queue.insert(next, op.value, ValueInfo());
+    } else if (UI != queue.end()) {
+      queue.erase(UI);
+    }
+  }
+
+  uint64_t sum = 0;
+  for (auto I: queue)
+    sum = sum * 31 + I->first;
+  return sum;
+}
+#endif
+
+
+template <typename RunT>
+double timeBest(RunT run, uint64_t& checksum)
+{
+  double best = 0;
+  for (unsigned r = 0; r < Repeat; r++) {
+    auto start = std::chrono::steady_clock::now();
+    checksum = run();
+    double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (r == 0 || time < best)
+      best = time;
+  }
+  return best;
+}
+
+}
+
+
+int main(int argc, char **argv)
+{
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "conversion queue microbenchmark\n");
+
+  if (OpsPerValue == 0 || Repeat == 0) {
+    errs() << "queue-bench: -ops and -repeat must be positive\n";
+    return 1;
+  }
+  SmallVector<StringRef, 8> fields;
+  StringRef(Sizes).split(fields, ',', -1, false);
+  std::vector<unsigned> sizes;
+  for (StringRef f: fields) {
+    unsigned size;
+    if (f.trim().getAsInteger(10, size) || size == 0) {
+      errs() << "queue-bench: invalid size \"" << f << "\"\n";
+      return 1;
+    }
+    sizes.push_back(size);
+  }
+#ifndef HAVE_MULTIVALUEMAP
+  if (Baseline)
+    errs() << "queue-bench: MultiValueMap.h not found, only ConversionQueue is timed\n";
+#endif
+
+  outs() << "queue,size,ops,seconds,ns_per_op\n";
+  for (unsigned size: sizes) {
+    std::vector<Op> ops = makeOps(size, size * OpsPerValue);
+    uint64_t sum;
+    double time = timeBest([&]() { return runConversionQueue(size, ops); }, sum);
+    outs() << "ConversionQueue," << size << "," << ops.size()
+           << format(",%.4f,%.1f\n", time, time * 1e9 / ops.size());
+#ifdef HAVE_MULTIVALUEMAP
+    if (Baseline) {
+      uint64_t baseSum;
+      double baseTime = timeBest([&]() { return runMultiValueMap(size, ops); }, baseSum);
+      outs() << "MultiValueMap," << size << "," << ops.size()
+             << format(",%.4f,%.1f\n", baseTime, baseTime * 1e9 / ops.size());
+      if (baseSum != sum) {
+        errs() << "queue-bench: the queues disagree on the final order\n";
+        return 1;
+      }
+    }
+#endif
+  }
+  return 0;
+}
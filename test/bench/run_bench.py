@@ -0,0 +1,176 @@
+#!/usr/bin/env python3
+"""Scalability benchmark of the taffoinit pass on synthetic modules.
+
+For every configuration and target size, a module is generated with
+gen_module.py and opt runs the taffoinit pass on it. The wall time, the
+peak memory of opt, optionally the size of the output bitcode, and the
+statistics of the pass (conversion queue size, function clones, propagation
+visits, metadata nodes) are collected in a CSV file.
+
+The statistics are only available when LLVM is built with assertions or
+with LLVM_FORCE_ENABLE_STATS.
+
+Example:
+  ./run_bench.py --plugin /path/to/LLVMTaffo.so --sizes 1e3,1e4,1e5,1e6 -o results.csv
+"""
+
+import argparse
+import csv
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import gen_module
+
+
+# Generator parameters of each configuration, on top of the defaults of
+# gen_module.py. The number of functions is derived from the target size.
+CONFIGS = {
+  'default': [],
+  'deep-calls': ['--call-depth', '64'],
+  'phi-heavy': ['--loops', '4', '--phis', '32'],
+  'structs': ['--struct-depth', '8', '--locals', '1'],
+  'backtracking': ['--backtracking', '0.8', '--force-no-float', '0.1'],
+  'globals': ['--globals', '256', '--global-uses', '16'],
+}
+
+STATS = {
+  'queue_size': 'ConversionQueueSize',
+  'clones': 'FunctionCloned',
+  'clones_reused': 'FunctionCloneReused',
+  'dead_functions': 'DeadFunctionsRemoved',
+  'visits': 'PropagationVisits',
+  'md_nodes_built': 'MDNodesBuilt',
+  'md_nodes_reused': 'MDNodesReused',
+  'md_arena_bytes': 'MDInfoArenaBytes',
+  'float_pruned': 'FloatIrrelevantPruned',
+}
+
+
+def generator_args(config, functions, seed):
+  return CONFIGS[config] + ['--functions', str(functions), '--seed', str(seed)]
+
+
+def instructions_per_function(config):
+  one = gen_module.generate(gen_module.parse_args(generator_args(config, 1, 0)))[1]
+  two = gen_module.generate(gen_module.parse_args(generator_args(config, 2, 0)))[1]
+  return max(1, two - one)
+
+
+def run_opt(args, module, threads, stats_file, bitcode=None, memory_report=None):
+  cmd = [args.opt, '-load', args.plugin, '-taffoinit',
+         '-taffo-init-threads=%d' % threads,
+         '-stats', '-stats-json', '-info-output-file=' + stats_file] + args.pass_args.split()
+  if memory_report:
+    cmd.append('-taffo-init-memory-report=' + memory_report)
+  cmd += ['-o', bitcode] if bitcode else ['-disable-output']
+  cmd.append(module)
+  start = time.perf_counter()
+  proc = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+  stderr = proc.stderr.read()
+  _, status, usage = os.wait4(proc.pid, 0)
+  wall = time.perf_counter() - start
+  if not os.WIFEXITED(status) or os.WEXITSTATUS(status) != 0:
+    sys.stderr.write(stderr.decode(errors='replace'))
+    raise RuntimeError('opt failed on %s' % module)
+  return wall, usage.ru_maxrss
+
+
+def read_stats(stats_file):
+  try:
+    with open(stats_file) as f:
+      stats = json.load(f)
+  except (OSError, ValueError):
+    return {}
+  res = {}
+  for column, name in STATS.items():
+    res[column] = stats.get('taffo-init.' + name, 0)
+  return res
+
+
+def read_memory_peak(report_file):
+  try:
+    with open(report_file) as f:
+      return json.load(f).get('estimated_peak_bytes', '')
+  except (OSError, ValueError):
+    return ''
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+  parser.add_argument('--opt', default='opt', help='opt executable')
+  parser.add_argument('--plugin', required=True, help='shared library which contains the taffoinit pass')
+  parser.add_argument('--configs', default=','.join(CONFIGS), help='comma separated list of configurations')
+  parser.add_argument('--sizes', default='1e3,1e4,1e5,1e6', help='comma separated list of target instruction counts')
+  parser.add_argument('--threads', default='1', help='comma separated list of values of -taffo-init-threads')
+  parser.add_argument('--repeat', type=int, default=3, help='runs per point, the fastest one is kept')
+  parser.add_argument('--seed', type=int, default=0)
+  parser.add_argument('--pass-args', default='',
+                      help='additional options of the pass, e.g. -taffo-init-memssa')
+  parser.add_argument('--bitcode', action='store_true',
+                      help='also measure the size of the output bitcode (in a separate, untimed run)')
+  parser.add_argument('--memory-reports', action='store_true',
+                      help='write the memory report of each point next to the generated modules')
+  parser.add_argument('--keep', help='directory where the generated modules are kept')
+  parser.add_argument('-o', '--output', default='-', help='CSV output file (default: stdout)')
+  args = parser.parse_args()
+
+  configs = args.configs.split(',')
+  for config in configs:
+    if config not in CONFIGS:
+      parser.error('unknown configuration %s' % config)
+  sizes = [int(float(s)) for s in args.sizes.split(',')]
+  threads = [int(t) for t in args.threads.split(',')]
+
+  out = sys.stdout if args.output == '-' else open(args.output, 'w', newline='')
+  writer = csv.writer(out)
+  writer.writerow(['config', 'target_size', 'instructions', 'functions', 'threads',
+                   'wall_s', 'peak_rss_kb', 'bitcode_bytes', 'estimated_peak_bytes'] + list(STATS))
+
+  workdir = args.keep or tempfile.mkdtemp(prefix='taffoinit-bench-')
+  os.makedirs(workdir, exist_ok=True)
+  for config in configs:
+    per_function = instructions_per_function(config)
+    for size in sizes:
+      functions = max(1, round(size / per_function))
+      gen_args = gen_module.parse_args(generator_args(config, functions, args.seed))
+      text, count = gen_module.generate(gen_args)
+      module = os.path.join(workdir, '%s-%d.ll' % (config, size))
+      with open(module, 'w') as f:
+        f.write(text)
+
+      for t in threads:
+        stats_file = os.path.join(workdir, '%s-%d-%d.json' % (config, size, t))
+        memory_report = None
+        if args.memory_reports:
+          memory_report = os.path.join(workdir, '%s-%d-%d.memory.json' % (config, size, t))
+        best = None
+        for _ in range(args.repeat):
+          wall, rss = run_opt(args, module, t, stats_file, memory_report=memory_report)
+          if best is None or wall < best[0]:
+            best = (wall, rss)
+        bitcode_size = ''
+        if args.bitcode:
+          bitcode = os.path.join(workdir, '%s-%d-%d.bc' % (config, size, t))
+          run_opt(args, module, t, stats_file, bitcode)
+          bitcode_size = os.path.getsize(bitcode)
+          os.remove(bitcode)
+        stats = read_stats(stats_file)
+        memory_peak = read_memory_peak(memory_report) if memory_report else ''
+        writer.writerow([config, size, count, functions, t, '%.3f' % best[0], best[1], bitcode_size,
+                         memory_peak] + [stats.get(c, '') for c in STATS])
+        out.flush()
+
+      if not args.keep:
+        os.remove(module)
+
+  if out is not sys.stdout:
+    out.close()
+
+
+if __name__ == '__main__':
+  main()
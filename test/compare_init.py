@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+"""Compares the metadata produced by two builds of the taffoinit pass.
+
+Each input is run through opt with both plugins, and the taffo.* metadata
+attached to the globals, the functions and the instructions of the output is
+dumped in a form which does not depend on the numbering of the metadata
+nodes or on the names of the function clones. The dumps are compared, and
+the differences are printed as a unified diff.
+
+The clones are identified by their source function and by the metadata of
+their arguments, the instructions by their position in the function.
+
+With --dump, only --plugin is run and its dump is printed, so that it can be
+saved and compared later.
+
+Example:
+  ./compare_init.py --baseline-plugin /path/to/old/LLVMTaffo.so \\
+      --plugin /path/to/new/LLVMTaffo.so test1.ll global.ll backtracking_phi.ll
+"""
+
+import argparse
+import difflib
+import glob
+import os
+import re
+import subprocess
+import sys
+
+
+METADATA_DEF = re.compile(r'^!(\d+) = (?:distinct )?(.*)$')
+METADATA_REF = re.compile(r'!(\d+)\b')
+ATTACHMENT = re.compile(r'!(taffo\.[\w.]+) !(\d+)')
+FUNCTION_DEF = re.compile(r'^define [^@]*@("[^"]+"|[\w.$-]+)\(')
+GLOBAL_DEF = re.compile(r'^@("[^"]+"|[\w.$-]+) = ')
+FUNCTION_REF = re.compile(r'@("[^"]+"|[\w.$-]+)')
+INSTRUCTION = re.compile(r'^\s+(?:(%[\w.$-]+|%"[^"]+") = )?(\w+)')
+
+
+def parse_args(argv=None):
+  parser = argparse.ArgumentParser(description=__doc__,
+                                   formatter_class=argparse.RawDescriptionHelpFormatter)
+  parser.add_argument('inputs', nargs='*',
+                      help='LLVM IR or bitcode files (default: the .ll files next to this script)')
+  parser.add_argument('--opt', default='opt', help='opt executable (default: %(default)s)')
+  parser.add_argument('--plugin', required=True, help='taffoinit plugin to check')
+  parser.add_argument('--baseline-plugin', help='taffoinit plugin of reference')
+  parser.add_argument('--pass-args', default='',
+                      help='extra options of the pass, only for --plugin')
+  parser.add_argument('--dump', action='store_true',
+                      help='print the dump of --plugin instead of comparing')
+  args = parser.parse_args(argv)
+  if not args.dump and not args.baseline_plugin:
+    parser.error('--baseline-plugin is required unless --dump is given')
+  if not args.inputs:
+    here = os.path.dirname(os.path.abspath(__file__))
+    args.inputs = sorted(glob.glob(os.path.join(here, '*.ll')))
+  return args
+
+
+def run_pass(opt, plugin, extra, path):
+  cmd = [opt, '-load', plugin, '-taffoinit', '-S', '-o', '-'] + extra + [path]
+  proc = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                        universal_newlines=True)
+  if proc.returncode != 0:
+    sys.stderr.write(proc.stderr)
+    raise RuntimeError('%s failed on %s' % (opt, path))
+  return proc.stdout
+
+
+class MetadataExpander:
+  """Replaces the references to numbered metadata nodes with their contents"""
+
+  def __init__(self, lines):
+    self.nodes = {}
+    for line in lines:
+      m = METADATA_DEF.match(line)
+      if m:
+        self.nodes[m.group(1)] = m.group(2)
+    self.expanded = {}
+
+  def expand(self, ref, active=()):
+    if ref in self.expanded:
+      return self.expanded[ref]
+    if ref in active or ref not in self.nodes:
+      return '!<%s>' % ('cycle' if ref in active else 'missing')
+    active = active + (ref,)
+    text = METADATA_REF.sub(lambda m: self.expand(m.group(1), active), self.nodes[ref])
+    self.expanded[ref] = text
+    return text
+
+
+def dump_module(text):
+  """Returns the sorted lines "<value> <attachment> = <metadata>" of the
+  taffo.* attachments of the module"""
+  lines = text.splitlines()
+  md = MetadataExpander(lines)
+
+  entries = []  # (function name or None, value key, attachment, metadata)
+  function = None
+  index = 0
+  for line in lines:
+    if function is None:
+      m = FUNCTION_DEF.match(line)
+      if m:
+        function = m.group(1)
+        index = 0
+        for name, ref in ATTACHMENT.findall(line):
+          entries.append((function, '', name, md.expand(ref)))
+        continue
+      m = GLOBAL_DEF.match(line)
+      if m:
+        for name, ref in ATTACHMENT.findall(line):
+          entries.append((None, '@' + m.group(1), name, md.expand(ref)))
+      continue
+    if line.startswith('}'):
+      function = None
+      continue
+    m = INSTRUCTION.match(line)
+    if not m:
+      continue
+    key = '#%d %s' % (index, m.group(2))
+    if m.group(1) and not re.match(r'^%\d+$', m.group(1)):
+      key += ' ' + m.group(1)
+    index += 1
+    for name, ref in ATTACHMENT.findall(line):
+      entries.append((function, key, name, md.expand(ref)))
+
+  # name the clones after their source and the metadata of their arguments
+  functions = {}
+  for f, key, name, value in entries:
+    if f is not None and key == '':
+      functions.setdefault(f, {})[name] = value
+  names = {}
+  for f, attachments in functions.items():
+    source = attachments.get('taffo.sourceFunction')
+    if source:
+      m = FUNCTION_REF.search(source)
+      names[f] = 'clone of @%s %s' % (m.group(1) if m else source,
+                                       attachments.get('taffo.funinfo', '!{}'))
+  clones = {}
+  for f in sorted(names):
+    clones.setdefault(names[f], []).append(f)
+  for key, fs in clones.items():
+    for k, f in enumerate(fs):
+      names[f] = '%s [%d]' % (key, k) if len(fs) > 1 else key
+
+  def rename(value):
+    return FUNCTION_REF.sub(lambda m: '@<%s>' % names[m.group(1)]
+                            if m.group(1) in names else m.group(0), value)
+
+  result = []
+  for f, key, name, value in entries:
+    owner = names.get(f, '@' + f) if f is not None else ''
+    result.append(' '.join(filter(None, [owner, key, name])) + ' = ' + rename(value))
+  result.sort()
+  return result
+
+
+def main(argv=None):
+  args = parse_args(argv)
+  extra = args.pass_args.split()
+  different = False
+  for path in args.inputs:
+    new = dump_module(run_pass(args.opt, args.plugin, extra, path))
+    if args.dump:
+      print('; ' + path)
+      for line in new:
+        print(line)
+      continue
+    old = dump_module(run_pass(args.opt, args.baseline_plugin, [], path))
+    diff = list(difflib.unified_diff(old, new, path + ' (baseline)', path, lineterm=''))
+    if diff:
+      different = True
+      for line in diff:
+        print(line)
+    else:
+      print('%s: same metadata (%d attachments)' % (path, len(new)))
+  return 1 if different else 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())
@@ -0,0 +1,24 @@
+# -*- Python -*-
+# Configuration of the regression tests of the initializer, run by lit
+# through the check-taffo-init target.
+
+import os
+
+import lit.formats
+import lit.util
+
+config.name = 'TaffoInitializer'
+config.test_format = lit.formats.ShTest(not lit.util.which('bash'))
+config.suffixes = ['.ll']
+# global.ll and test1.ll are only inputs of compare_init.py
+config.excludes = ['bench', 'global.ll', 'test1.ll']
+
+config.test_source_root = os.path.dirname(__file__)
+config.test_exec_root = config.taffo_init_test_root
+
+config.environment['PATH'] = os.pathsep.join(
+    [config.taffo_init_tools_dir, config.llvm_tools_dir, config.environment.get('PATH', '')])
+
+# the initializer alone, as a plugin of opt (-load for the legacy pass
+# manager, -load-pass-plugin for the new one)
+config.substitutions.append(('%taffo_plugin', config.taffo_plugin))
@@ -0,0 +1,83 @@
+; Propagation through memory with concurrent partitions.
+; In each function the annotated value is stored to a field of a struct and
+; read back: the load is only reached through MemorySSA. The functions are
+; propagated by different threads, which query the memory dependences
+; computed before, serially. With the new pass manager the analyses come from
+; its analysis manager.
+;
+; RUN: opt -load %taffo_plugin -taffoinit -taffo-init-memssa -taffo-init-threads=4 -S %s | FileCheck %s
+; RUN: opt -load-pass-plugin %taffo_plugin -passes=taffoinit -taffo-init-memssa -taffo-init-threads=4 -S %s | FileCheck %s
+
+; CHECK-LABEL: define float @f0(
+; CHECK: %x = alloca {{.*}}!taffo.info ![[R0:[0-9]+]]
+; CHECK: %w = load {{.*}}!taffo.info ![[R0]]
+; CHECK-LABEL: define float @f1(
+; CHECK: %x = alloca {{.*}}!taffo.info ![[R1:[0-9]+]]
+; CHECK: %w = load {{.*}}!taffo.info ![[R1]]
+; CHECK-LABEL: define float @f2(
+; CHECK: %x = alloca {{.*}}!taffo.info ![[R2:[0-9]+]]
+; CHECK: %w = load {{.*}}!taffo.info ![[R2]]
+; CHECK-LABEL: define float @f3(
+; CHECK: %x = alloca {{.*}}!taffo.info ![[R3:[0-9]+]]
+; CHECK: %w = load {{.*}}!taffo.info ![[R3]]
+
+source_filename = "memssa_threads.ll"
+
+%struct.pt = type { float, float }
+
+@.str = private unnamed_addr constant [20 x i8] c"scalar(range(0, 8))\00", section "llvm.metadata"
+@.str.1 = private unnamed_addr constant [17 x i8] c"memssa_threads.c\00", section "llvm.metadata"
+
+define float @f0(%struct.pt* %p, float %in) {
+entry:
+  %x = alloca float, align 4
+  %x1 = bitcast float* %x to i8*
+  call void @llvm.var.annotation(i8* %x1, i8* getelementptr inbounds ([20 x i8], [20 x i8]* @.str, i32 0, i32 0), i8* getelementptr inbounds ([17 x i8], [17 x i8]* @.str.1, i32 0, i32 0), i32 3)
+  store float %in, float* %x, align 4
+  %v = load float, float* %x, align 4
+  %fy = getelementptr inbounds %struct.pt, %struct.pt* %p, i32 0, i32 1
+  store float %v, float* %fy, align 4
+  %w = load float, float* %fy, align 4
+  ret float %w
+}
+
+define float @f1(%struct.pt* %p, float %in) {
+entry:
+  %x = alloca float, align 4
+  %x1 = bitcast float* %x to i8*
+  call void @llvm.var.annotation(i8* %x1, i8* getelementptr inbounds ([20 x i8], [20 x i8]* @.str, i32 0, i32 0), i8* getelementptr inbounds ([17 x i8], [17 x i8]* @.str.1, i32 0, i32 0), i32 4)
+  store float %in, float* %x, align 4
+  %v = load float, float* %x, align 4
+  %fy = getelementptr inbounds %struct.pt, %struct.pt* %p, i32 0, i32 1
+  store float %v, float* %fy, align 4
+  %w = load float, float* %fy, align 4
+  ret float %w
+}
+
+define float @f2(%struct.pt* %p, float %in) {
+entry:
+  %x = alloca float, align 4
+  %x1 = bitcast float* %x to i8*
+  call void @llvm.var.annotation(i8* %x1, i8* getelementptr inbounds ([20 x i8], [20 x i8]* @.str, i32 0, i32 0), i8* getelementptr inbounds ([17 x i8], [17 x i8]* @.str.1, i32 0, i32 0), i32 5)
+  store float %in, float* %x, align 4
+  %v = load float, float* %x, align 4
+  %fy = getelementptr inbounds %struct.pt, %struct.pt* %p, i32 0, i32 1
+  store float %v, float* %fy, align 4
+  %w = load float, float* %fy, align 4
+  ret float %w
+}
+
+define float @f3(%struct.pt* %p, float %in) {
+entry:
+  %x = alloca float, align 4
+  %x1 = bitcast float* %x to i8*
+  call void @llvm.var.annotation(i8* %x1, i8* getelementptr inbounds ([20 x i8], [20 x i8]* @.str, i32 0, i32 0), i8* getelementptr inbounds ([17 x i8], [17 x i8]* @.str.1, i32 0, i32 0), i32 6)
+  store float %in, float* %x, align 4
+  %v = load float, float* %x, align 4
+  %fy = getelementptr inbounds %struct.pt, %struct.pt* %p, i32 0, i32 1
+  store float %v, float* %fy, align 4
+  %w = load float, float* %fy, align 4
+  ret float %w
+}
+
+declare void @llvm.var.annotation(i8*, i8*, i8*, i32)
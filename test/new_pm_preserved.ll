@@ -0,0 +1,55 @@
+; Analyses preserved by the new pass manager version of the initializer.
+; The annotation call of %x is removed and the call of @scale is redirected
+; to a clone. The CFG of the existing functions is untouched, therefore their
+; dominator tree and loop info survive, while their MemorySSA, which contains
+; the removed and the redirected calls, is computed again.
+;
+; RUN: opt -load-pass-plugin %taffo_plugin -disable-output -debug-pass-manager \
+; RUN:   -passes='function(require<domtree>,require<loops>,require<memoryssa>),taffoinit,function(require<domtree>,require<loops>,require<memoryssa>)' \
+; RUN:   %s 2>&1 | FileCheck %s
+
+; CHECK: Running analysis: DominatorTreeAnalysis on caller
+; CHECK: Running analysis: LoopAnalysis on caller
+; CHECK: Running analysis: MemorySSAAnalysis on caller
+; CHECK: Running pass: {{.*}}TaffoInitializerPass
+; CHECK-NOT: Invalidating analysis: DominatorTreeAnalysis
+; CHECK-NOT: Invalidating analysis: LoopAnalysis
+; CHECK: Invalidating analysis: MemorySSAAnalysis on caller
+; CHECK-NOT: Running analysis: DominatorTreeAnalysis on caller
+; CHECK-NOT: Running analysis: LoopAnalysis on caller
+; CHECK: Running analysis: MemorySSAAnalysis on caller
+
+source_filename = "new_pm_preserved.ll"
+
+@.str = private unnamed_addr constant [20 x i8] c"scalar(range(0, 8))\00", section "llvm.metadata"
+@.str.1 = private unnamed_addr constant [19 x i8] c"new_pm_preserved.c\00", section "llvm.metadata"
+
+define float @scale(float %v, i32 %n) {
+entry:
+  br label %loop
+
+loop:                                             ; preds = %loop, %entry
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi float [ %v, %entry ], [ %next, %loop ]
+  %next = fmul float %acc, 2.000000e+00
+  %i.next = add nsw i32 %i, 1
+  %cmp = icmp slt i32 %i.next, %n
+  br i1 %cmp, label %loop, label %exit
+
+exit:                                             ; preds = %loop
+  ret float %next
+}
+
+define float @caller(float* %in, i32 %n) {
+entry:
+  %x = alloca float, align 4
+  %x1 = bitcast float* %x to i8*
+  call void @llvm.var.annotation(i8* %x1, i8* getelementptr inbounds ([20 x i8], [20 x i8]* @.str, i32 0, i32 0), i8* getelementptr inbounds ([19 x i8], [19 x i8]* @.str.1, i32 0, i32 0), i32 3)
+  %0 = load float, float* %in, align 4
+  store float %0, float* %x, align 4
+  %v = load float, float* %x, align 4
+  %r = call float @scale(float %v, i32 %n)
+  ret float %r
+}
+
+declare void @llvm.var.annotation(i8*, i8*, i8*, i32)
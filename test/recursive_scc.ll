@@ -0,0 +1,77 @@
+; Specialization of a recursive SCC.
+; @main_f calls @f with the range of %x, while @g, which @f calls, passes the
+; range of its own annotated %y back to @f. The clones of @f and @g for the
+; call of @main_f are built again from the union of the two ranges, and the
+; recursive calls are bound to them. The call of the original @g, which only
+; carries the range of %y, gets clones of its own.
+;
+; RUN: opt -load %taffo_plugin -taffoinit -S %s | FileCheck %s
+
+; CHECK-LABEL: define float @main_f(
+; CHECK: call float @[[F:f\.[0-9]+]](float %v, i32 3)
+; CHECK: define internal float @[[F]](float %x, i32 %n) {{.*}}!taffo.funinfo ![[JOINED:[0-9]+]]
+; CHECK: call float @[[G:g\.[0-9]+]](float %x0, i32 %m)
+; CHECK: define internal float @[[G]](float %x, i32 %n) {{.*}}!taffo.funinfo ![[JOINED]]
+; CHECK: call float @[[F]](float %v, i32 %n)
+; CHECK: define internal float @[[F2:f\.[0-9]+]](float %x, i32 %n) {{.*}}!taffo.funinfo ![[Y:[0-9]+]]
+; CHECK: call float @[[G2:g\.[0-9]+]](float %x0, i32 %m)
+; CHECK: define internal float @[[G2]](float %x, i32 %n) {{.*}}!taffo.funinfo ![[Y]]
+; CHECK: call float @[[F2]](float %v, i32 %n)
+; CHECK-DAG: ![[JOINED]] = !{i32 1, ![[JOINEDINFO:[0-9]+]], i32 0, !"void"}
+; CHECK-DAG: ![[JOINEDINFO]] = !{!"gen", ![[JOINEDRANGE:[0-9]+]], !"gen", i32 1}
+; CHECK-DAG: ![[JOINEDRANGE]] = !{double 0.000000e+00, double 1.000000e+01}
+; CHECK-DAG: ![[Y]] = !{i32 1, ![[YINFO:[0-9]+]], i32 0, !"void"}
+; CHECK-DAG: ![[YINFO]] = !{!"gen", ![[YRANGE:[0-9]+]], !"gen", i32 1}
+; CHECK-DAG: ![[YRANGE]] = !{double 5.000000e+00, double 1.000000e+01}
+
+source_filename = "recursive_scc.ll"
+
+@.str = private unnamed_addr constant [20 x i8] c"scalar(range(0, 1))\00", section "llvm.metadata"
+@.str.1 = private unnamed_addr constant [21 x i8] c"scalar(range(5, 10))\00", section "llvm.metadata"
+@.str.2 = private unnamed_addr constant [6 x i8] c"rec.c\00", section "llvm.metadata"
+
+define float @f(float %x, i32 %n) {
+entry:
+  %x.addr = alloca float, align 4
+  store float %x, float* %x.addr, align 4
+  %c = icmp sgt i32 %n, 0
+  br i1 %c, label %rec, label %done
+rec:
+  %m = sub i32 %n, 1
+  %x0 = load float, float* %x.addr, align 4
+  %r = call float @g(float %x0, i32 %m)
+  ret float %r
+done:
+  %x1 = load float, float* %x.addr, align 4
+  ret float %x1
+}
+
+define float @g(float %x, i32 %n) {
+entry:
+  %x.addr = alloca float, align 4
+  %y = alloca float, align 4
+  store float %x, float* %x.addr, align 4
+  %y1 = bitcast float* %y to i8*
+  call void @llvm.var.annotation(i8* %y1, i8* getelementptr inbounds ([21 x i8], [21 x i8]* @.str.1, i32 0, i32 0), i8* getelementptr inbounds ([6 x i8], [6 x i8]* @.str.2, i32 0, i32 0), i32 1)
+  %x0 = load float, float* %x.addr, align 4
+  %a = fmul float %x0, 2.0
+  store float %a, float* %y, align 4
+  %v = load float, float* %y, align 4
+  %r = call float @f(float %v, i32 %n)
+  %x2 = load float, float* %x.addr, align 4
+  %s = fadd float %r, %x2
+  ret float %s
+}
+
+define float @main_f(float %in) {
+entry:
+  %x = alloca float, align 4
+  %x1 = bitcast float* %x to i8*
+  call void @llvm.var.annotation(i8* %x1, i8* getelementptr inbounds ([20 x i8], [20 x i8]* @.str, i32 0, i32 0), i8* getelementptr inbounds ([6 x i8], [6 x i8]* @.str.2, i32 0, i32 0), i32 2)
+  store float %in, float* %x, align 4
+  %v = load float, float* %x, align 4
+  %r = call float @f(float %v, i32 3)
+  ret float %r
+}
+
+declare void @llvm.var.annotation(i8*, i8*, i8*, i32)